@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtGui>
+#include "../source/resampler.h"
+
+namespace
+{
+  // Each size is fitted this many times, and the quickest run reported
+  const int Runs = 5;
+}
+
+
+/**
+ * Checks that the resampler's SIMD kernels give exactly what the scalar ones
+ * do, and times fitting a wallpaper to some common screen sizes.
+ * @returns 1 if the kernels disagree, so that the check can be run as a test
+ */
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+  QTextStream out(stdout);
+
+  if (!Resampler::selfTest()) {
+    out << "FAIL: SIMD and scalar resampling differ\n";
+    return 1;
+  }
+  out << "SIMD and scalar resampling agree\n";
+
+  QImage image(1280, 800, QImage::Format_ARGB32);
+  uint seed = 1;
+  for (int y = 0; y < image.height(); y++) {
+    QRgb* line = (QRgb*)image.scanLine(y);
+    for (int x = 0; x < image.width(); x++) {
+      seed = seed * 1103515245 + 12345;
+      line[x] = seed;
+    }
+  }
+
+  QList<QSize> sizes;
+  sizes << QSize(1024, 768) << QSize(1920, 1080) << QSize(2560, 1440) <<
+           QSize(3840, 2160);
+  foreach (QSize size, sizes) {
+    int best = -1;
+    for (int run = 0; run < Runs; run++) {
+      QTime clock;
+      clock.start();
+      Resampler::fit(image, size);
+      int elapsed = clock.elapsed();
+      if (best < 0 || elapsed < best) {
+        best = elapsed;
+      }
+    }
+    out << "1280x800 to " << size.width() << "x" << size.height() << ": " <<
+           best << " ms\n";
+  }
+  return 0;
+}
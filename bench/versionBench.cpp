@@ -0,0 +1,229 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore>
+#include <algorithm>
+#include "../source/versionNumber.h"
+
+namespace
+{
+  // Each operation is timed over this many iterations, and the quickest of
+  // several runs reported
+  const int Iterations = 200000;
+  const int Runs = 5;
+
+  struct Ordering
+  {
+    const char* lower;
+    const char* higher;
+  };
+
+  const Ordering Orderings[] = {
+    { "1.2", "1.3" },
+    { "1.9", "1.10" },
+    { "1.3-beta", "1.3" },
+    { "1.3-alpha", "1.3-beta" },
+    { "1.3-beta.2", "1.3-beta.11" },
+    { "1.3-1", "1.3-alpha" },
+    { "1.3-beta", "1.3-beta.1" },
+    { "1.2.9.9", "1.3" }
+  };
+
+  struct Membership
+  {
+    const char* range;
+    const char* version;
+    bool contained;
+  };
+
+  const Membership Memberships[] = {
+    { "", "1.0", true },
+    { ">=1.3 <2", "1.3", true },
+    { ">=1.3 <2", "2.0", false },
+    { "<1.2 || >=1.4", "1.3", false },
+    { "<1.2 || >=1.4", "1.5", true },
+    { "=1.3", "1.3.0", true },
+    { "<1.2 ||", "1.3", false },
+    { "|| <1.2", "1.3", false },
+    { ">=1.x", "1.3", false }
+  };
+
+  /*!
+   * The string-splitting version number that VersionNumber replaced, kept
+   * here to be timed against it
+   */
+  class OldVersionNumber
+  {
+    public:
+      explicit OldVersionNumber(QString versionString)
+        : mChunks(versionString.split('.'))
+      {
+        // Remove any trailing chunks that equate to zero
+        bool isInt;
+        while (!mChunks.isEmpty() &&
+               mChunks.last().toInt(&isInt) == 0 && isInt) {
+          mChunks.removeLast();
+        }
+      }
+
+      static int compare(const OldVersionNumber& v1,
+                         const OldVersionNumber& v2)
+      {
+        int vCounts[2] = {v1.mChunks.count(), v2.mChunks.count()};
+        int numChunksToCompare = std::min(vCounts[0], vCounts[1]);
+        int diff = 0;
+        for (int i = 0; i < numChunksToCompare && diff == 0; i++) {
+          diff = QString::compare(v1.mChunks[i], v2.mChunks[i]);
+        }
+        if (diff == 0) {
+          diff = vCounts[0] - vCounts[1];
+        }
+        return diff;
+      }
+
+      bool operator<(const OldVersionNumber& rhs) const
+      {
+        return compare(*this, rhs) < 0;
+      }
+
+    private:
+      QStringList mChunks;
+  };
+
+  // Both are timed on the same versions, the kind compared at startup and
+  // on each update check (the old one, comparing text, orders them wrongly)
+  const char* const VersionA = "1.3.12";
+  const char* const VersionB = "1.3.9";
+
+  /*!
+   * Returns the quickest of several runs of \a function, in milliseconds
+   */
+  int bestOf(int (*function)())
+  {
+    int best = -1;
+    for (int run = 0; run < Runs; run++) {
+      QTime clock;
+      clock.start();
+      function();
+      int elapsed = clock.elapsed();
+      if (best < 0 || elapsed < best) {
+        best = elapsed;
+      }
+    }
+    return best;
+  }
+
+  // Each parse is followed by a comparison, so that its result is used
+  int parseNew()
+  {
+    QString version(VersionA);
+    VersionNumber other(VersionB);
+    int less = 0;
+    for (int i = 0; i < Iterations; i++) {
+      less += (other < VersionNumber(version));
+    }
+    return less;
+  }
+
+  int parseOld()
+  {
+    QString version(VersionA);
+    OldVersionNumber other((QString(VersionB)));
+    int less = 0;
+    for (int i = 0; i < Iterations; i++) {
+      less += (other < OldVersionNumber(version));
+    }
+    return less;
+  }
+
+  int compareNew()
+  {
+    VersionNumber a(VersionA);
+    VersionNumber b(VersionB);
+    int less = 0;
+    for (int i = 0; i < Iterations; i++) {
+      less += (b < a);
+    }
+    return less;
+  }
+
+  int compareOld()
+  {
+    OldVersionNumber a((QString(VersionA)));
+    OldVersionNumber b((QString(VersionB)));
+    int less = 0;
+    for (int i = 0; i < Iterations; i++) {
+      less += (b < a);
+    }
+    return less;
+  }
+}
+
+
+/**
+ * Checks that versions are ordered and ranges matched as documented, and
+ * times parsing and comparing versions against the implementation that
+ * VersionNumber replaced.
+ * @returns 1 if any check fails, so that the checks can be run as a test
+ */
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+  QTextStream out(stdout);
+
+  bool ok = true;
+  for (uint i = 0; i < sizeof(Orderings) / sizeof(Orderings[0]); i++) {
+    VersionNumber lower(Orderings[i].lower);
+    VersionNumber higher(Orderings[i].higher);
+    if (!(lower < higher) || higher < lower) {
+      out << "FAIL: " << Orderings[i].lower << " should come before " <<
+             Orderings[i].higher << "\n";
+      ok = false;
+    }
+  }
+  for (uint i = 0; i < sizeof(Memberships) / sizeof(Memberships[0]); i++) {
+    const Membership& m = Memberships[i];
+    if (VersionRange(m.range).contains(VersionNumber(m.version)) !=
+        m.contained) {
+      out << "FAIL: \"" << m.range << "\" should " <<
+             (m.contained ? "" : "not ") << "contain " << m.version << "\n";
+      ok = false;
+    }
+  }
+  if (!ok) {
+    return 1;
+  }
+  out << "Versions are ordered and ranges matched as expected\n";
+
+  out << "Per " << Iterations << " operations, new vs. old:\n";
+  out << "Parsing: " << bestOf(parseNew) << " ms vs. " <<
+         bestOf(parseOld) << " ms\n";
+  out << "Comparing: " << bestOf(compareNew) << " ms vs. " <<
+         bestOf(compareOld) << " ms\n";
+  return 0;
+}
@@ -0,0 +1,303 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore>
+#include "../source/wallpaperSetter.h"
+
+namespace
+{
+  // How long any one setter may take before the check gives up on it
+  const int WaitMsecs = 10000;
+
+  // Short enough to keep the timeout checks quick
+  const int TimeoutSecs = 1;
+
+  const char* const PrimaryFile = "/tmp/b.jpg";
+
+  /*!
+   * Sleeps well past the timeout, like a desktop that has stopped responding
+   */
+  bool hangingCall(const QStringList&, int)
+  {
+    QMutex mutex;
+    QMutexLocker locker(&mutex);
+    QWaitCondition().wait(&mutex, TimeoutSecs * 3000);
+    return true;
+  }
+
+  bool succeedingCall(const QStringList&, int)
+  {
+    return true;
+  }
+
+  /*!
+   * A blocking backend with a stand-in for the call it makes
+   */
+  class StubBlockingSetter : public BlockingSetter
+  {
+    public:
+      StubBlockingSetter(BlockingCall call) : BlockingSetter(call) {}
+      QString name() const { return "stub"; }
+
+    protected:
+      QString failureMessage() const { return "The stub failed."; }
+  };
+}
+
+
+/*!
+ * Runs a setter to completion, and holds on to the outcome
+ */
+class SetterRun : public QObject
+{
+  Q_OBJECT
+
+  public:
+    SetterRun(WallpaperSetter* setter)
+      : mSetter(setter), mFinished(false), mSucceeded(false)
+    {
+      connect(setter, SIGNAL(finished(bool, const QString&)),
+              this, SLOT(setterFinished(bool, const QString&)));
+    }
+
+    /*!
+     * Sets the test images, returning true if the setter finished in time
+     */
+    bool run()
+    {
+      mSetter->start(QStringList() << "/tmp/a.jpg" << PrimaryFile, 1);
+      QTimer::singleShot(WaitMsecs, &mLoop, SLOT(quit()));
+      if (!mFinished) {
+        mLoop.exec();
+      }
+      return mFinished;
+    }
+
+    bool succeeded() const { return mSucceeded; }
+    QString errorString() const { return mErrorString; }
+
+  private slots:
+    void setterFinished(bool succeeded, const QString& errorString)
+    {
+      mFinished = true;
+      mSucceeded = succeeded;
+      mErrorString = errorString;
+      mLoop.quit();
+    }
+
+  private:
+    WallpaperSetter* mSetter;
+    QEventLoop mLoop;
+    bool mFinished;
+    bool mSucceeded;
+    QString mErrorString;
+};
+
+
+namespace
+{
+  QDir stubDir;
+  QTextStream out(stdout);
+
+  /*!
+   * Writes a stand-in for the program \a name that logs its arguments, one
+   * run per line, and then runs \a body
+   */
+  void writeStub(const QString& name, const QString& body = QString())
+  {
+    QFile file(stubDir.filePath(name));
+    file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    file.write(QString("#!/bin/sh\n"
+                       "echo \"${0##*/} $*\" >> \"%1\"\n"
+                       "%2\n").arg(stubDir.filePath("log")).
+                                arg(body).toLocal8Bit());
+    file.close();
+    file.setPermissions(QFile::ReadOwner | QFile::WriteOwner |
+                        QFile::ExeOwner);
+  }
+
+  /*!
+   * Returns the lines logged by the stubs since the last call
+   */
+  QStringList takeLog()
+  {
+    QFile file(stubDir.filePath("log"));
+    file.open(QIODevice::ReadOnly);
+    QStringList lines = QString::fromLocal8Bit(file.readAll()).
+                          split('\n', QString::SkipEmptyParts);
+    file.close();
+    file.remove();
+    return lines;
+  }
+
+  /*!
+   * Removes the stubs written so far
+   */
+  void clearStubs()
+  {
+    foreach (QString name, stubDir.entryList(QDir::Files)) {
+      stubDir.remove(name);
+    }
+  }
+
+  /*!
+   * Picks the backend \a name under \a desktop, runs it and checks that it
+   * succeeds (or fails) and makes the \a expected calls.  Returns true if
+   * all is well.
+   */
+  bool check(const QString& name, const char* desktop, bool shouldSucceed,
+             const QStringList& expected)
+  {
+    qputenv("XDG_CURRENT_DESKTOP", desktop);
+    QSettings().setValue("wallpaper/setter", name);
+    WallpaperSetter* setter = WallpaperSetter::detect();
+    if (!setter || setter->name() != name) {
+      out << "FAIL: " << name << " was not picked\n";
+      delete setter;
+      return false;
+    }
+
+    SetterRun run(setter);
+    bool ok = true;
+    if (!run.run()) {
+      out << "FAIL: " << name << " did not finish\n";
+      ok = false;
+    } else if (run.succeeded() != shouldSucceed) {
+      out << "FAIL: " << name << " should have " <<
+             (shouldSucceed ? "succeeded" : "failed") << " (" <<
+             run.errorString() << ")\n";
+      ok = false;
+    }
+    delete setter;
+
+    QStringList log = takeLog();
+    if (ok && log != expected) {
+      out << "FAIL: " << name << " ran:\n  " << log.join("\n  ") <<
+             "\ninstead of:\n  " << expected.join("\n  ") << "\n";
+      ok = false;
+    }
+    clearStubs();
+    return ok;
+  }
+
+  /*!
+   * Runs a blocking backend whose call is \a call, checking that it
+   * succeeds or fails as it should.  Returns true if all is well.
+   */
+  bool checkBlocking(BlockingSetter::BlockingCall call, bool shouldSucceed)
+  {
+    StubBlockingSetter setter(call);
+    SetterRun run(&setter);
+    if (!run.run() || run.succeeded() != shouldSucceed) {
+      out << "FAIL: blocking call should have " <<
+             (shouldSucceed ? "succeeded" : "timed out") << "\n";
+      return false;
+    }
+    return true;
+  }
+}
+
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+  app.setOrganizationName("Logos Wallpaper Setter Test");
+  app.setApplicationName("wallpapersettertest");
+  QSettings().clear();
+  QSettings().setValue("wallpaper/setterTimeoutSecs", TimeoutSecs);
+
+  stubDir = QDir(QDir::temp().filePath(
+    QString("logos-setter-test-%1").arg(app.applicationPid())));
+  stubDir.mkpath(".");
+  qputenv("PATH", (stubDir.path() + ":").toLocal8Bit() + qgetenv("PATH"));
+  qputenv("DISPLAY", ":0");
+
+  QString uri = QUrl::fromLocalFile(PrimaryFile).toString();
+  QString backdrop = "/backdrop/screen0/monitorHDMI-1/workspace0/last-image";
+  bool ok = true;
+
+  // The dark-style setting is optional, so its failure doesn't count
+  writeStub("gsettings", "case \"$*\" in *dark*) exit 1;; esac");
+  ok &= check("gnome", "GNOME", true, QStringList() <<
+    "gsettings set org.gnome.desktop.background picture-uri " + uri <<
+    "gsettings set org.gnome.desktop.background picture-uri-dark " + uri);
+
+  writeStub("qdbus");
+  ok &= check("kde", "KDE", true, QStringList() <<
+    "qdbus org.kde.plasmashell /PlasmaShell "
+    "org.kde.PlasmaShell.evaluateScript var files = [\"file:///tmp/a.jpg\", "
+    "\"file:///tmp/b.jpg\"];var all = desktops();"
+    "for (var i = 0; i < all.length; i++) {  var d = all[i];"
+    "  d.wallpaperPlugin = \"org.kde.image\";"
+    "  d.currentConfigGroup = [\"Wallpaper\", \"org.kde.image\","
+    "                          \"General\"];"
+    "  d.writeConfig(\"Image\", files[Math.min(i, files.length - 1)]);}");
+
+  writeStub("xfconf-query", QString("case \"$*\" in *-l) echo %1;; esac").
+                              arg(backdrop));
+  ok &= check("xfce", "XFCE", true, QStringList() <<
+    "xfconf-query -c xfce4-desktop -l" <<
+    "xfconf-query -c xfce4-desktop -p " + backdrop + " -s " + PrimaryFile);
+
+  // With no backdrops listed, the first one is created
+  writeStub("xfconf-query");
+  ok &= check("xfce", "XFCE", true, QStringList() <<
+    "xfconf-query -c xfce4-desktop -l" <<
+    QString("xfconf-query -c xfce4-desktop -p "
+            "/backdrop/screen0/monitor0/workspace0/last-image -n -t string "
+            "-s ") + PrimaryFile);
+
+  writeStub("feh");
+  ok &= check("feh", "", true, QStringList() <<
+    "feh --no-fehbg --bg-fill /tmp/a.jpg /tmp/b.jpg");
+
+  writeStub("xwallpaper");
+  ok &= check("xwallpaper", "", true, QStringList() <<
+    QString("xwallpaper --zoom ") + PrimaryFile);
+
+  writeStub("xwallpaper", "exit 1");
+  ok &= check("xwallpaper", "", false, QStringList() <<
+    QString("xwallpaper --zoom ") + PrimaryFile);
+
+  writeStub("feh", QString("sleep %1").arg(TimeoutSecs * 3));
+  ok &= check("feh", "", false, QStringList() <<
+    "feh --no-fehbg --bg-fill /tmp/a.jpg /tmp/b.jpg");
+
+  ok &= checkBlocking(succeedingCall, true);
+  ok &= checkBlocking(hangingCall, false);
+
+  QSettings().clear();
+  QDir::temp().rmdir(stubDir.dirName());
+  if (!ok) {
+    return 1;
+  }
+  out << "Each backend made the expected calls, and gave up when stuck\n";
+  return 0;
+}
+
+#include "wallpaperSetterTest.moc"
@@ -33,7 +33,25 @@
 #include "helpDialog.h"
 #include "wallpaperGetter.h"
 #include "applicationUpdater.h"
+#include "prefetchScheduler.h"
+#include "deadlineScheduler.h"
 
+#ifdef Q_WS_WIN
+#include <windows.h>
+#endif
+
+namespace
+{
+  // How long after startup to leave the network alone, so as not to compete
+  // with the rest of the session logging in
+  const int DefaultStartupDelaySecs = 30;
+
+  // Until this month's wallpaper is set, we check back after this long,
+  // doubling with each check up to the limit, unless the wallpaper getter
+  // says when to try again
+  const int RefreshCheckSecs = 10 * 60;
+  const int MaxRefreshCheckSecs = 6 * 60 * 60;
+}
 
 /**
  * Constructor
@@ -46,26 +64,47 @@ Application::Application(int& argc, char* argv[])
     mTrayMenu(new QMenu()),
     mAppUpgradeActionGroup(NULL),
     mWallpaperGetter(NULL),
-    mCurrentWallpaperMonth(0)
+    mScheduler(NULL),
+    mAppUpdater(NULL),
+    mPrefetchScheduler(NULL),
+    mCurrentWallpaperMonth(0),
+    mMonthChecks(0),
+    mAppliedCachedWallpaper(false),
+    mStartupClock(),
+    mStartupTimed(false)
 {
+  mStartupClock.start();
+
   QCoreApplication::setOrganizationName("Operation Mobilisation");
   QCoreApplication::setApplicationName("Logos Wallpaper Updater");
 
   setQuitOnLastWindowClosed(false);
 
+  // Random delays must differ between machines, or they are of no use
+  qsrand(QDateTime::currentDateTime().toTime_t() ^ applicationPid());
+
+  // Everything that happens at a set time is woken by this
+  mScheduler = new DeadlineScheduler(this);
+
   // Application updates
-  ApplicationUpdater* appUpdater = new ApplicationUpdater(this);
+  mAppUpdater = new ApplicationUpdater(mScheduler, this);
 
   // Wallpaper getter
   mWallpaperGetter = new WallpaperGetter(this);
   connect(mWallpaperGetter, SIGNAL(wallpaperSet()),
           this, SLOT(wallpaperSet()));
+  connect(mWallpaperGetter, SIGNAL(refreshFailed()),
+          this, SLOT(scheduleMonthCheck()));
+
+  // Fetch next month's wallpaper ahead of time
+  mPrefetchScheduler =
+    new PrefetchScheduler(mWallpaperGetter, mScheduler, this);
 
   // System tray menu
   QAction* action;
 
   QString actionName;
-  if (WallpaperGetter::canSetWallpaper()) {
+  if (mWallpaperGetter->canSetWallpaper()) {
     actionName = tr("Set wallpaper");
   } else {
     actionName = tr("Get wallpaper");
@@ -80,7 +119,7 @@ Application::Application(int& argc, char* argv[])
 
   mAppUpgradeActionGroup = new QActionGroup(mTrayMenu.data());
   mAppUpgradeActionGroup->setVisible(false);
-  connect(appUpdater, SIGNAL(newVersionAvailable()),
+  connect(mAppUpdater, SIGNAL(newVersionAvailable()),
           this, SLOT(unhideAppUpgradeActionGroup()));
 
   action = mTrayMenu->addSeparator();
@@ -89,7 +128,7 @@ Application::Application(int& argc, char* argv[])
   action = mTrayMenu->addAction(tr("Upgrade this application"));
   action->setActionGroup(mAppUpgradeActionGroup);
   connect(action, SIGNAL(triggered(bool)),
-          appUpdater, SLOT(startUpdate()));
+          mAppUpdater, SLOT(startUpdate()));
 
   action = mTrayMenu->addSeparator();
 
@@ -113,14 +152,16 @@ Application::Application(int& argc, char* argv[])
 
   mTray->setContextMenu(mTrayMenu.data());
   mTray->show();
+  qDebug() << "Tray shown after" << mStartupClock.elapsed() << "ms";
 
-  // Set the wallpaper on startup
-  mWallpaperGetter->refreshWallpaperWithProgress();
-
-  // Check the month every minute (startTimer doesn't work well here)
-  QTimer* timer = new QTimer(this);
-  connect(timer, SIGNAL(timeout()), this, SLOT(updateInterval()));
-  timer->start(60 * 1000);
+  // Put back the wallpaper set last time straight away; anything that needs
+  // the network waits until the session has settled down
+  mAppliedCachedWallpaper = mWallpaperGetter->applyCachedWallpaper();
+  QSettings settings;
+  int delaySecs =
+    settings.value("startup/delaySecs", DefaultStartupDelaySecs).toInt();
+  QTimer::singleShot(qMax(0, delaySecs) * 1000,
+                     this, SLOT(startBackgroundWork()));
 }
 
 /**
@@ -130,6 +171,37 @@ Application::~Application()
 {
 }
 
+/**
+ * Called when another instance, or an installer, is about to take over from
+ * this one
+ */
+void Application::handOver()
+{
+  mAppUpdater->handOver();
+}
+
+/**
+ * Starts the work held back at startup: checking for a new wallpaper and
+ * application version, and scheduling the prefetch
+ */
+void Application::startBackgroundWork()
+{
+  connect(mWallpaperGetter, SIGNAL(wallpaperSet()),
+          mPrefetchScheduler, SLOT(reschedule()));
+  mPrefetchScheduler->reschedule();
+  mAppUpdater->start();
+
+  // Check back in case the refresh fails
+  scheduleMonthCheck();
+
+  // If the cached wallpaper went up, there's only news to look for
+  if (mAppliedCachedWallpaper) {
+    mWallpaperGetter->refreshWallpaperQuietly();
+  } else {
+    mWallpaperGetter->refreshWallpaperWithProgress();
+  }
+}
+
 /**
  * Opens a QDialog of type T, or focuses it if it is already open.
  * This method creates a dialog of the specified type, and stores a pointer to
@@ -214,17 +286,66 @@ void Application::unhideAppUpgradeActionGroup()
 }
 
 /**
- * Update interval
+ * Called when the month may have changed, or when it's time to try again
+ * after failing to fetch this month's wallpaper; refreshes the wallpaper if
+ * it isn't this month's
  */
-void Application::updateInterval()
+void Application::checkMonth()
 {
-  // refresh the wallpaper if the month has changed
+  scheduleMonthCheck();
+
   int currentMonth = QDate::currentDate().month();
   if (currentMonth != mCurrentWallpaperMonth) {
+    mMonthChecks++;
     mWallpaperGetter->refreshWallpaperQuietly();
   }
 }
 
+/**
+ * Sets the deadline for the next checkMonth(): the start of next month if
+ * this month's wallpaper is set, or else when the wallpaper getter is next
+ * willing to ask the server for it, backing off if it has no opinion.
+ * Without a way of setting the wallpaper, there is nothing to check on.
+ */
+void Application::scheduleMonthCheck()
+{
+  QDateTime now = QDateTime::currentDateTime();
+  QDate today = now.date();
+  QDateTime when(QDate(today.year(), today.month(), 1).addMonths(1));
+
+  if (today.month() != mCurrentWallpaperMonth &&
+      mWallpaperGetter->canSetWallpaper()) {
+    QDateTime retry = mWallpaperGetter->nextRefreshAttempt();
+    if (!retry.isValid() || retry <= now) {
+      int delaySecs = qMin(RefreshCheckSecs << qMin(mMonthChecks, 10),
+                           MaxRefreshCheckSecs);
+      // Between half and all of it, so that machines don't line up
+      delaySecs -= (int)(delaySecs / 2 * (qrand() / (RAND_MAX + 1.0)));
+      retry = now.addSecs(delaySecs);
+    }
+    when = qMin(when, retry);
+  }
+
+  mScheduler->schedule(this, "checkMonth", when);
+}
+
+#ifdef Q_WS_WIN
+/**
+ * Watches for the clock being changed and the system resuming, since the
+ * deadlines must then be measured afresh
+ */
+bool Application::winEventFilter(MSG* message, long* result)
+{
+  if (message->message == WM_TIMECHANGE ||
+      (message->message == WM_POWERBROADCAST &&
+       (message->wParam == PBT_APMRESUMEAUTOMATIC ||
+        message->wParam == PBT_APMRESUMESUSPEND))) {
+    mScheduler->rearm();
+  }
+  return QApplication::winEventFilter(message, result);
+}
+#endif
+
 /**
  * Called when the wallpaper is updated; remembers which month it corresponds to
  * so we don't check for new wallpaper for the rest of the month.
@@ -232,4 +353,11 @@ void Application::updateInterval()
 void Application::wallpaperSet()
 {
   mCurrentWallpaperMonth = QDate::currentDate().month();
+  mMonthChecks = 0;
+  scheduleMonthCheck();
+
+  if (!mStartupTimed) {
+    mStartupTimed = true;
+    qDebug() << "Wallpaper set after" << mStartupClock.elapsed() << "ms";
+  }
 }
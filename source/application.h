@@ -35,6 +35,9 @@
 class AboutDialog;
 class HelpDialog;
 class WallpaperGetter;
+class ApplicationUpdater;
+class PrefetchScheduler;
+class DeadlineScheduler;
 
 class Application : public QApplication
 {
@@ -45,24 +48,39 @@ class Application : public QApplication
     ~Application();
     void showTrayMessage(QString message);
 
+  public slots:
+    void handOver();
+
   private slots:
     void showAboutDialog();
     void showHelpDialog();
     void openWebsite() const;
     void unhideAppUpgradeActionGroup();
-    void updateInterval();
+    void checkMonth();
+    void scheduleMonthCheck();
     void wallpaperSet();
+    void startBackgroundWork();
 
   private:
     template<class T>
       void showDialog(QPointer<T>* dialogPointer, bool* createdNewPtr = 0);
+#ifdef Q_WS_WIN
+    bool winEventFilter(MSG* message, long* result);
+#endif
     QPointer<AboutDialog> mAboutDialog;
     QPointer<HelpDialog> mHelpDialog;
     QScopedPointer<QSystemTrayIcon> mTray;
     QScopedPointer<QMenu> mTrayMenu;
     QActionGroup* mAppUpgradeActionGroup;
     WallpaperGetter* mWallpaperGetter;
+    DeadlineScheduler* mScheduler;
+    ApplicationUpdater* mAppUpdater;
+    PrefetchScheduler* mPrefetchScheduler;
     int mCurrentWallpaperMonth;
+    int mMonthChecks;
+    bool mAppliedCachedWallpaper;
+    QTime mStartupClock;
+    bool mStartupTimed;
 };
 
 #endif
@@ -30,37 +30,148 @@
 #include "application.h"
 #include "defines.h"
 #include "versionNumber.h"
+#include "deadlineScheduler.h"
+#include "wallpaperDownload.h"
+#include "atomicFile.h"
+
+#ifdef Q_WS_WIN
+#include <windows.h>
+#endif
+
+namespace
+{
+  // How often to check for a new version, on average
+  const int CheckIntervalSecs = 60 * 60;
+  // After failing to reach any mirror, the interval doubles up to this limit
+  const int MaxCheckIntervalSecs = 24 * 60 * 60;
+  // The first check after startup, if one is due, is spread over this long
+  const int StartupJitterSecs = 10 * 60;
+  // Installer packages are fetched no faster than this, so as to leave the
+  // network to everything else
+  const int PackageRateLimit = 48 * 1024;
+
+  /**
+   * Returns a random number of seconds in the range [0, limit)
+   */
+  int randomSecs(int limit)
+  {
+    return (int)(limit * (qrand() / (RAND_MAX + 1.0)));
+  }
+
+  /**
+   * Returns the name the update file gives this platform's installer package
+   * and patches, or an empty string if there are none for it
+   */
+  QString platformName()
+  {
+    if (WINDOWS) {
+      return "Windows";
+    } else if (MACOS_X) {
+      return "Mac";
+    }
+    return QString();
+  }
+}
 
 
 /**
  * Constructor
  */
-ApplicationUpdater::ApplicationUpdater(QObject* parent)
+ApplicationUpdater::ApplicationUpdater(DeadlineScheduler* scheduler,
+                                       QObject* parent)
   : QObject(parent),
-    mNextMirrorIndex(0),
-    mManager(),
+    mScheduler(scheduler),
+    mManager(NULL),
     mUpdateData(),
     mUpdateFileMirrors(
       QStringList() <<
         "http://cloud.github.com/downloads/giddie/logos-wallpaper-updater/"
           "updates.txt" <<
-        "http://www.danns.co.uk/webfm_send/57")
+        "http://www.danns.co.uk/webfm_send/57"),
+    mNotifiedVersion(),
+    mMirrors(mUpdateFileMirrors, "updateMirrorStats"),
+    mRankedMirrors(),
+    mNextMirror(0),
+    mReplies(),
+    mHedgeTimer(),
+    mClock(),
+    mPackageDownload(NULL),
+    mHandedOver(false),
+    mPatchChain(),
+    mPatchWatcher(),
+    mPatchBase(),
+    mPatchTarget(),
+    mPatchVersion(),
+    mPatchHash()
 {
-  connect(&mManager, SIGNAL(finished(QNetworkReply*)),
-          this, SLOT(downloadFinished(QNetworkReply*)));
+  mHedgeTimer.setSingleShot(true);
+  connect(&mHedgeTimer, SIGNAL(timeout()), this, SLOT(hedge()));
+  connect(qApp, SIGNAL(aboutToQuit()), this, SLOT(installOnQuit()));
+  connect(&mPatchWatcher, SIGNAL(finished()), this, SLOT(patchesApplied()));
+}
 
-  // Check for new version every hour
-  startTimer(60 * 60 * 1000);
+/**
+ * Destructor; waits for any patching under way, since it writes into the
+ * staging directory
+ */
+ApplicationUpdater::~ApplicationUpdater()
+{
+  mPatchWatcher.waitForFinished();
+}
+
+/**
+ * Picks up the update file kept from last time, and schedules the first
+ * check: at a random point in the interval since the last one if that was
+ * recent, or else within the next few minutes
+ */
+void ApplicationUpdater::start()
+{
+  QSettings settings;
+  // A package staged for this version has been installed, and is kept to
+  // patch from; one for an older version has no more use
+  QString baseVersion = settings.value("updates/baseVersion").toString();
+  QString stagedVersion = settings.value("updates/stagedVersion").toString();
+  if (!baseVersion.isEmpty() &&
+      VersionNumber(baseVersion) != VersionNumber::application()) {
+    discardBasePackage();
+  }
+  if (!stagedVersion.isEmpty() &&
+      VersionNumber(stagedVersion) == VersionNumber::application()) {
+    discardBasePackage();
+    settings.setValue("updates/basePackage",
+                      settings.value("updates/stagedPackage"));
+    settings.setValue("updates/baseVersion", stagedVersion);
+    settings.remove("updates/stagedPackage");
+    settings.remove("updates/stagedVersion");
+  } else if (!stagedVersion.isEmpty() &&
+             VersionNumber(stagedVersion) < VersionNumber::application()) {
+    discardStagedUpdate();
+  }
+  useUpdateData(parse(settings.value("updates/file").toByteArray()));
 
-  // Check straight away as well
-  checkForNewVersion();
+  uint now = QDateTime::currentDateTime().toTime_t();
+  uint lastChecked = settings.value("updates/lastChecked").toUInt();
+  int sinceSecs = (lastChecked != 0 && lastChecked <= now) ?
+                    (int)qMin(now - lastChecked, (uint)CheckIntervalSecs) :
+                    CheckIntervalSecs;
+  if (sinceSecs < CheckIntervalSecs) {
+    scheduleCheck(CheckIntervalSecs / 2 - sinceSecs +
+                  randomSecs(CheckIntervalSecs));
+  } else {
+    scheduleCheck(randomSecs(StartupJitterSecs));
+  }
 }
 
 /**
- * Destructor
+ * Returns true if the installer for a newer version has been downloaded and
+ * verified, and is ready to run
  */
-ApplicationUpdater::~ApplicationUpdater()
+bool ApplicationUpdater::hasStagedUpdate() const
 {
+  QSettings settings;
+  QString version = settings.value("updates/stagedVersion").toString();
+  return VersionNumber(version) > VersionNumber::application() &&
+         QFile::exists(settings.value("updates/stagedPackage").toString());
 }
 
 /**
@@ -68,45 +179,172 @@ ApplicationUpdater::~ApplicationUpdater()
  */
 void ApplicationUpdater::checkForNewVersion()
 {
-  // Start by trying the first mirror
-  mNextMirrorIndex = 0;
+  if (!mReplies.isEmpty()) {
+    return;
+  }
+  mRankedMirrors = mMirrors.ranked();
+  mNextMirror = 0;
+  mClock.start();
   tryNextMirror();
 }
 
 /**
- * Parses the update file to see if a newer version is available
+ * Parses the update file to see if a newer version is available.  A 304
+ * means the file kept from last time is still current.
  */
 void ApplicationUpdater::downloadFinished(QNetworkReply* reply)
 {
+  reply->deleteLater();
+  if (!mReplies.removeAll(reply)) {
+    // Cancelled after another mirror answered, or part of a package download
+    return;
+  }
+
+  QSettings settings;
+  int status =
+    reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  QByteArray data;
   if (reply->error() == QNetworkReply::NoError) {
-    while (!reply->atEnd()) {
-      QString line = QString(reply->readLine());
-      QString key = line.section(':', 0, 0).trimmed();
-      QString value = line.section(':', 1, -1).trimmed();
-      mUpdateData.insert(key, value);
+    data = (status == 304) ? settings.value("updates/file").toByteArray() :
+                             reply->readAll();
+  }
+
+  // Each answer is judged on its own, so a bad one can't taint a good one
+  if (useUpdateData(parse(data))) {
+    mMirrors.recordFirstByte(reply->url(),
+                             mClock.elapsed() -
+                               reply->property("launchedAt").toInt());
+    if (status != 304) {
+      settings.setValue("updates/file", data);
+      settings.setValue("updates/mirror", reply->url().toString());
+      settings.setValue("updates/eTag", reply->rawHeader("ETag"));
+      settings.setValue("updates/lastModified",
+                        reply->rawHeader("Last-Modified"));
+    }
+    fetchPackage();
+    finishCheck(true);
+  } else {
+    // Something's wrong with this update file; try the next mirror, unless
+    // one is already being asked
+    mMirrors.recordFailure(reply->url());
+    if (mReplies.isEmpty()) {
+      tryNextMirror();
     }
   }
+}
+
+/**
+ * Called when the mirrors asked so far are slow to answer; asks the next
+ * one as well
+ */
+void ApplicationUpdater::hedge()
+{
+  tryNextMirror();
+}
+
+/**
+ * Called when the installer package has finished downloading.  If it checks
+ * out, it takes the place of any package staged before.
+ */
+void ApplicationUpdater::packageFinished(WallpaperDownload* download)
+{
+  mPackageDownload = NULL;
+  download->deleteLater();
+  keepPartialPackage(download);
+
+  if (download->result() == WallpaperDownload::Success) {
+    stagePackage(download->property("version").toString(),
+                 download->fileName());
+  } else {
+    qWarning() << "Unable to download the update package:" <<
+                  download->errorString();
+  }
+  releaseNetworkManager();
+}
+
+/**
+ * Called when a patch has finished downloading; moves on to the next, or
+ * applies them all once they are here.  If the network let us down, the
+ * patches are tried again at the next check.
+ */
+void ApplicationUpdater::patchFinished(WallpaperDownload* download)
+{
+  mPackageDownload = NULL;
+  download->deleteLater();
+  keepPartialPackage(download);
+
+  if (download->result() == WallpaperDownload::Success) {
+    fetchNextPatch();
+  } else if (download->result() == WallpaperDownload::NetworkFailure) {
+    mPatchChain.clear();
+    releaseNetworkManager();
+  } else {
+    abandonPatches();
+  }
+}
 
-  if (mUpdateData["Application"] == APP_NAME) {
-    if (VersionNumber(mUpdateData["Version"]) > VersionNumber(APP_VERSION)) {
-      emit newVersionAvailable();
-      qobject_cast<Application*>(qApp)->
-        showTrayMessage(tr("There is a new version of the "
-                           "Logos Wallpaper Updater available."));
+/**
+ * Called when the patches have been applied; stages the result if it is
+ * exactly the package the update file describes
+ */
+void ApplicationUpdater::patchesApplied()
+{
+  QByteArray hash = mPatchWatcher.result();
+  QString output = mPatchTarget + ".patched";
+  if (!hash.isEmpty() && hash == mPatchHash &&
+      AtomicFile::replace(output, mPatchTarget)) {
+    foreach (const BinaryPatch::Step& step, mPatchChain) {
+      QFile::remove(patchFileName(step));
     }
+    mPatchChain.clear();
+    stagePackage(mPatchVersion, mPatchTarget);
+    releaseNetworkManager();
   } else {
-    // Something's wrong with this update file; try the next mirror.
-    tryNextMirror();
+    QFile::remove(output);
+    abandonPatches();
   }
+}
 
-  reply->deleteLater();
+/**
+ * Called as the application quits.  Keeps whatever has arrived of the
+ * package for next time, and on Windows runs the staged installer silently,
+ * unless another instance or an installer is already taking over.
+ */
+void ApplicationUpdater::installOnQuit()
+{
+  if (mPackageDownload) {
+    mPackageDownload->suspend();
+    keepPartialPackage(mPackageDownload);
+    delete mPackageDownload;
+    mPackageDownload = NULL;
+  }
+  if (WINDOWS && !mHandedOver && hasStagedUpdate()) {
+    launchInstaller("/S");
+  }
+}
+
+/**
+ * Called when another instance has asked this one to quit, so that the staged
+ * installer is not run on the way out
+ */
+void ApplicationUpdater::handOver()
+{
+  mHandedOver = true;
 }
 
 /**
- * Starts upgrading the application
+ * Starts upgrading the application: runs the staged installer if there is
+ * one, and otherwise opens the download site
  */
 void ApplicationUpdater::startUpdate()
 {
+  // The installer quits this instance, through the InstanceManager, before
+  // it replaces anything
+  if (hasStagedUpdate() && launchInstaller(QString())) {
+    mHandedOver = true;
+    return;
+  }
+
   QUrl downloadSite = mUpdateData["DownloadSite"];
   if (!downloadSite.isEmpty()) {
     QDesktopServices::openUrl(downloadSite);
@@ -114,21 +352,425 @@ void ApplicationUpdater::startUpdate()
 }
 
 /**
- * Timer event
+ * Splits an update file into its "Key: value" lines
+ */
+QHash<QString, QString> ApplicationUpdater::parse(const QByteArray& data)
+{
+  QHash<QString, QString> result;
+  foreach (QByteArray rawLine, data.split('\n')) {
+    QString line = QString(rawLine);
+    QString key = line.section(':', 0, 0).trimmed();
+    QString value = line.section(':', 1, -1).trimmed();
+    if (!key.isEmpty()) {
+      result.insert(key, value);
+    }
+  }
+  return result;
+}
+
+/**
+ * Adopts the parsed update file \a data if it is for this application, and
+ * lets the user know the first time it offers a newer version
+ * @returns false if the file isn't for this application
  */
-void ApplicationUpdater::timerEvent(QTimerEvent* event)
+bool ApplicationUpdater::useUpdateData(const QHash<QString, QString>& data)
 {
-  checkForNewVersion();
+  if (data.value("Application") != APP_NAME) {
+    return false;
+  }
+  mUpdateData = data;
+
+  QString version = mUpdateData["Version"];
+  if (offersUpdate() && version != mNotifiedVersion) {
+    mNotifiedVersion = version;
+    emit newVersionAvailable();
+    qobject_cast<Application*>(qApp)->
+      showTrayMessage(tr("There is a new version of the "
+                         "Logos Wallpaper Updater available."));
+  }
+  return true;
 }
 
 /**
- * Tries to download the update file from the mirror corresponding to the given
- * index
+ * Returns true if the update file offers a newer version than this one, and
+ * is meant for this one.  The file may give the range of versions it applies
+ * to under "Versions", such as ">=1.3 <2", so that different versions can be
+ * kept on different channels.
+ */
+bool ApplicationUpdater::offersUpdate() const
+{
+  const VersionNumber& current = VersionNumber::application();
+  return VersionNumber(mUpdateData.value("Version")) > current &&
+         VersionRange(mUpdateData.value("Versions")).contains(current);
+}
+
+/**
+ * Asks the next mirror in order of speed for the update file, and sets the
+ * hedge timer in case it's slow.  The mirror that sent the file kept from
+ * last time is asked only whether it has changed.  Once every mirror has
+ * failed, the check is over.
  */
 void ApplicationUpdater::tryNextMirror()
 {
-  if (mNextMirrorIndex < mUpdateFileMirrors.size()) {
-    QString url = mUpdateFileMirrors[mNextMirrorIndex++];
-    QNetworkReply* reply = mManager.get(QNetworkRequest(url));
+  mHedgeTimer.stop();
+  if (mNextMirror < mRankedMirrors.size()) {
+    QString url = mRankedMirrors[mNextMirror++];
+    QNetworkRequest request(url);
+
+    QSettings settings;
+    if (settings.value("updates/mirror").toString() == url &&
+        !settings.value("updates/file").toByteArray().isEmpty()) {
+      QByteArray eTag = settings.value("updates/eTag").toByteArray();
+      QByteArray lastModified =
+        settings.value("updates/lastModified").toByteArray();
+      if (!eTag.isEmpty()) {
+        request.setRawHeader("If-None-Match", eTag);
+      }
+      if (!lastModified.isEmpty()) {
+        request.setRawHeader("If-Modified-Since", lastModified);
+      }
+    }
+    QNetworkReply* reply = networkManager()->get(request);
+    reply->setProperty("launchedAt", mClock.elapsed());
+    mReplies << reply;
+
+    if (mNextMirror < mRankedMirrors.size()) {
+      mHedgeTimer.start(mMirrors.hedgeDelay(url));
+    }
+  } else if (mReplies.isEmpty()) {
+    finishCheck(false);
+  }
+}
+
+/**
+ * Lets go of the network manager unless a package is still downloading, and
+ * schedules the next check: at a random point across the interval, which
+ * doubles with each failure in a row
+ */
+void ApplicationUpdater::finishCheck(bool succeeded)
+{
+  mHedgeTimer.stop();
+
+  // Cancel the requests to any other mirrors
+  QList<QNetworkReply*> replies = mReplies;
+  mReplies.clear();
+  foreach (QNetworkReply* reply, replies) {
+    reply->abort();
+  }
+
+  releaseNetworkManager();
+
+  QSettings settings;
+  int failures = succeeded ? 0 : settings.value("updates/failures").toInt() + 1;
+  settings.setValue("updates/failures", failures);
+  settings.setValue("updates/lastChecked",
+                    QDateTime::currentDateTime().toTime_t());
+
+  int intervalSecs =
+    qMin(CheckIntervalSecs << qMin(failures, 10), MaxCheckIntervalSecs);
+  scheduleCheck(intervalSecs / 2 + randomSecs(intervalSecs));
+}
+
+/**
+ * Sets the next check for \a delaySecs from now
+ */
+void ApplicationUpdater::scheduleCheck(int delaySecs)
+{
+  QDateTime when = QDateTime::currentDateTime().addSecs(qMax(0, delaySecs));
+  mScheduler->schedule(this, "checkForNewVersion", when);
+}
+
+/**
+ * Returns the network access manager, creating it if need be.  It is only
+ * kept while a check or a package download is in progress.
+ */
+QNetworkAccessManager* ApplicationUpdater::networkManager()
+{
+  if (!mManager) {
+    mManager = new QNetworkAccessManager(this);
+    connect(mManager, SIGNAL(finished(QNetworkReply*)),
+            this, SLOT(downloadFinished(QNetworkReply*)));
+  }
+  return mManager;
+}
+
+/**
+ * Lets go of the network manager, if nothing is using it
+ */
+void ApplicationUpdater::releaseNetworkManager()
+{
+  if (mManager && mReplies.isEmpty() && !mPackageDownload &&
+      mPatchChain.isEmpty()) {
+    mManager->deleteLater();
+    mManager = NULL;
+  }
+}
+
+/**
+ * Starts downloading the installer package for the version on offer, if it
+ * is newer than this one, has a hash to check it against, and isn't staged
+ * already.  Patches are fetched instead where they work out cheaper.
+ */
+void ApplicationUpdater::fetchPackage()
+{
+  QString platform = platformName();
+  QString version = mUpdateData["Version"];
+  QUrl url = mUpdateData.value(platform + "Package");
+  QByteArray hash =
+    mUpdateData.value(platform + "PackageSHA256").toAscii().toLower();
+  QString baseName = QFileInfo(url.path()).fileName();
+  if (mPackageDownload || !mPatchChain.isEmpty() || platform.isEmpty() ||
+      !url.isValid() || baseName.isEmpty() || hash.isEmpty() ||
+      !offersUpdate()) {
+    return;
+  }
+
+  QSettings settings;
+  if (hasStagedUpdate() &&
+      settings.value("updates/stagedVersion").toString() == version) {
+    return;
+  }
+
+  QString directory =
+    QDesktopServices::storageLocation(QDesktopServices::DataLocation) +
+    "/updates/" + version;
+  QString fileName = directory + "/" + baseName;
+  if (!QDir().mkpath(directory)) {
+    return;
+  }
+
+  if (!fetchPatches(version, fileName, hash) &&
+      startPackageDownload(url, fileName, hash,
+                           SLOT(packageFinished(WallpaperDownload*)))) {
+    mPackageDownload->setProperty("version", version);
+  }
+}
+
+/**
+ * Starts on the cheapest chain of patches from the package kept for this
+ * version to the one on offer, as long as it comes to less than the whole
+ * package and patching hasn't already failed for this version
+ * @returns false if the whole package is to be fetched instead
+ */
+bool ApplicationUpdater::fetchPatches(const QString& version,
+                                      const QString& fileName,
+                                      const QByteArray& hash)
+{
+  QSettings settings;
+  QString base = settings.value("updates/basePackage").toString();
+  if (base.isEmpty() || !QFile::exists(base) ||
+      settings.value("updates/patchFailed").toString() == version) {
+    return false;
+  }
+
+  QString platform = platformName();
+  qint64 cost = 0;
+  BinaryPatch::Chain chain =
+    BinaryPatch::cheapestChain(BinaryPatch::parse(mUpdateData,
+                                                  platform + "Patch"),
+                               APP_VERSION, version, &cost);
+  qint64 packageSize = mUpdateData.value(platform + "PackageSize").toLongLong();
+  if (chain.isEmpty() || (packageSize > 0 && cost >= packageSize)) {
+    return false;
+  }
+
+  mPatchChain = chain;
+  mPatchBase = base;
+  mPatchTarget = fileName;
+  mPatchVersion = version;
+  mPatchHash = hash;
+  fetchNextPatch();
+  return true;
+}
+
+/**
+ * Downloads the first patch in the chain that isn't here yet, or once they
+ * all are, applies them on a worker thread.  A patch file is only ever
+ * written once it has passed its check, so any found from an earlier attempt
+ * can be used as it is.
+ */
+void ApplicationUpdater::fetchNextPatch()
+{
+  QStringList patches;
+  foreach (const BinaryPatch::Step& step, mPatchChain) {
+    QString fileName = patchFileName(step);
+    if (!QFile::exists(fileName)) {
+      if (!startPackageDownload(step.url, fileName, step.hash,
+                                SLOT(patchFinished(WallpaperDownload*)))) {
+        abandonPatches();
+      }
+      return;
+    }
+    patches << fileName;
+  }
+  mPatchWatcher.setFuture(QtConcurrent::run(&BinaryPatch::apply, mPatchBase,
+                                            patches,
+                                            mPatchTarget + ".patched"));
+}
+
+/**
+ * Gives up on patching to the version on offer, and fetches the whole
+ * package instead.  Whatever went wrong is likely to go wrong again, so
+ * patching isn't tried again for this version.
+ */
+void ApplicationUpdater::abandonPatches()
+{
+  qWarning() << "Unable to patch the update package; fetching all of it";
+  QSettings settings;
+  settings.setValue("updates/patchFailed", mPatchVersion);
+  foreach (const BinaryPatch::Step& step, mPatchChain) {
+    QFile::remove(patchFileName(step));
+  }
+  mPatchChain.clear();
+  fetchPackage();
+  releaseNetworkManager();
+}
+
+/**
+ * Returns where the patch for \a step is downloaded to
+ */
+QString ApplicationUpdater::patchFileName(const BinaryPatch::Step& step) const
+{
+  return QFileInfo(mPatchTarget).path() + "/" + step.from + "-" + step.to +
+         ".patch";
+}
+
+/**
+ * Starts rate-limited download of \a url to \a fileName, carrying on from
+ * where an earlier attempt left off if it was at the same file, and checking
+ * the result against \a hash.  \a finishedSlot is called when it's done.
+ * @returns false if the download could not be started
+ */
+bool ApplicationUpdater::startPackageDownload(const QUrl& url,
+                                              const QString& fileName,
+                                              const QByteArray& hash,
+                                              const char* finishedSlot)
+{
+  mPackageDownload =
+    new WallpaperDownload(networkManager(), url, fileName, this);
+  mPackageDownload->setExpectedHash(hash);
+  mPackageDownload->setRateLimit(PackageRateLimit);
+
+  // Pick up the last attempt if it was at the same file; otherwise its
+  // leftovers are of no use
+  QSettings settings;
+  QString partialPackage = settings.value("updates/partialPackage").toString();
+  if (partialPackage == fileName) {
+    mPackageDownload->resumeFrom(
+      settings.value("updates/partialETag").toByteArray(),
+      settings.value("updates/partialLastModified").toByteArray());
+  } else if (!partialPackage.isEmpty()) {
+    QFile::remove(AtomicFile::tempFileName(partialPackage));
+    if (QFileInfo(partialPackage).path() != QFileInfo(fileName).path()) {
+      QDir().rmdir(QFileInfo(partialPackage).path());
+    }
+  }
+
+  connect(mPackageDownload, SIGNAL(finished(WallpaperDownload*)),
+          this, finishedSlot);
+  if (!mPackageDownload->start()) {
+    delete mPackageDownload;
+    mPackageDownload = NULL;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Makes \a fileName the staged package for \a version, in place of any
+ * staged before, and lets the user know
+ */
+void ApplicationUpdater::stagePackage(const QString& version,
+                                      const QString& fileName)
+{
+  QSettings settings;
+  if (settings.value("updates/stagedPackage").toString() != fileName) {
+    discardStagedUpdate();
+  }
+  settings.setValue("updates/stagedVersion", version);
+  settings.setValue("updates/stagedPackage", fileName);
+
+  Application* app = qobject_cast<Application*>(qApp);
+  if (WINDOWS) {
+    app->showTrayMessage(tr("The new version of the Logos Wallpaper "
+                            "Updater has been downloaded, and will be "
+                            "installed when you quit."));
+  } else {
+    app->showTrayMessage(tr("The new version of the Logos Wallpaper "
+                            "Updater has been downloaded, and is ready "
+                            "to install."));
+  }
+}
+
+/**
+ * Removes the staged package, if any
+ */
+void ApplicationUpdater::discardStagedUpdate()
+{
+  QSettings settings;
+  QString fileName = settings.value("updates/stagedPackage").toString();
+  if (!fileName.isEmpty()) {
+    QFile::remove(fileName);
+    QDir().rmdir(QFileInfo(fileName).path());
+  }
+  settings.remove("updates/stagedPackage");
+  settings.remove("updates/stagedVersion");
+}
+
+/**
+ * Removes the package kept for patching from, if any
+ */
+void ApplicationUpdater::discardBasePackage()
+{
+  QSettings settings;
+  QString fileName = settings.value("updates/basePackage").toString();
+  if (!fileName.isEmpty()) {
+    QFile::remove(fileName);
+    QDir().rmdir(QFileInfo(fileName).path());
   }
+  settings.remove("updates/basePackage");
+  settings.remove("updates/baseVersion");
+}
+
+/**
+ * Records where \a download got to, if it left a partial file that can be
+ * resumed, and otherwise forgets any earlier partial file
+ */
+void ApplicationUpdater::keepPartialPackage(WallpaperDownload* download)
+{
+  QSettings settings;
+  if (download->hasPartialFile()) {
+    settings.setValue("updates/partialPackage", download->fileName());
+    settings.setValue("updates/partialETag", download->eTag());
+    settings.setValue("updates/partialLastModified",
+                      download->lastModified());
+  } else {
+    settings.remove("updates/partialPackage");
+    settings.remove("updates/partialETag");
+    settings.remove("updates/partialLastModified");
+  }
+}
+
+/**
+ * Runs the staged installer with the given command-line \a arguments, which
+ * are ignored except on Windows
+ * @returns false if it could not be started
+ */
+bool ApplicationUpdater::launchInstaller(const QString& arguments)
+{
+  QSettings settings;
+  QString fileName = settings.value("updates/stagedPackage").toString();
+#ifdef Q_WS_WIN
+  // The installer needs elevating, which only the shell will do for us
+  QString nativeName = QDir::toNativeSeparators(fileName);
+  HINSTANCE result =
+    ShellExecuteW(NULL, L"open", (const wchar_t*)nativeName.utf16(),
+                  arguments.isEmpty() ?
+                    NULL : (const wchar_t*)arguments.utf16(),
+                  NULL, SW_SHOWNORMAL);
+  return (int)(INT_PTR)result > 32;
+#else
+  Q_UNUSED(arguments);
+  return QDesktopServices::openUrl(QUrl::fromLocalFile(fileName));
+#endif
 }
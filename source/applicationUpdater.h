@@ -30,15 +30,43 @@
 #define APPLICATIONUPDATER_H
 
 #include <QtNetwork>
+#include "mirrorScoreboard.h"
+#include "binaryPatch.h"
 
+class DeadlineScheduler;
+class WallpaperDownload;
 
+/**
+ * Checks now and then whether a newer version of the application has been
+ * published.  Checks are spread at random across the check interval, so that
+ * machines don't all ask at once, and back off when no mirror can be reached.
+ * The last update file fetched is kept, along with the validators the server
+ * sent with it, so that most checks are answered with a bodiless 304.
+ *
+ * The mirror that has been quickest lately is asked first; if it is slow to
+ * answer, the next is asked as well, and so on.  The first usable answer
+ * wins, and the other requests are cancelled.
+ *
+ * Where the update file names an installer package for this platform, along
+ * with its SHA-256 hash, the package is fetched in the background at a gentle
+ * rate, picking up where it left off if interrupted, and staged once it has
+ * been verified.  The package for the running version is kept once it has
+ * been installed, and if the update file lists binary patches from it that
+ * add up to less than the new package, those are fetched and applied
+ * instead.  If the patched package fails its check, the whole one is
+ * fetched after all.  On Windows the staged installer runs silently as the
+ * application quits; "Upgrade this application" runs it straight away, and it
+ * asks this instance to quit through the InstanceManager before installing.
+ */
 class ApplicationUpdater : public QObject
 {
   Q_OBJECT
 
   public:
-    ApplicationUpdater(QObject* parent = 0);
+    ApplicationUpdater(DeadlineScheduler* scheduler, QObject* parent = 0);
     ~ApplicationUpdater();
+    void start();
+    bool hasStagedUpdate() const;
 
   signals:
     void newVersionAvailable();
@@ -46,18 +74,59 @@ class ApplicationUpdater : public QObject
   public slots:
     void checkForNewVersion();
     void startUpdate();
+    void handOver();
 
   private slots:
     void downloadFinished(QNetworkReply* reply);
+    void hedge();
+    void packageFinished(WallpaperDownload* download);
+    void patchFinished(WallpaperDownload* download);
+    void patchesApplied();
+    void installOnQuit();
 
   private:
-    int mNextMirrorIndex;
-    QNetworkAccessManager mManager;
+    DeadlineScheduler* mScheduler;
+    QNetworkAccessManager* mManager;
     QHash<QString, QString> mUpdateData;
     const QStringList mUpdateFileMirrors;
+    QString mNotifiedVersion;
+    MirrorScoreboard mMirrors;
+    QStringList mRankedMirrors;
+    int mNextMirror;
+    QList<QNetworkReply*> mReplies;
+    QTimer mHedgeTimer;
+    QTime mClock;
+    WallpaperDownload* mPackageDownload;
+    bool mHandedOver;
+    BinaryPatch::Chain mPatchChain;
+    QFutureWatcher<QByteArray> mPatchWatcher;
+    QString mPatchBase;
+    QString mPatchTarget;
+    QString mPatchVersion;
+    QByteArray mPatchHash;
 
-    void timerEvent(QTimerEvent* event);
+    static QHash<QString, QString> parse(const QByteArray& data);
+    bool useUpdateData(const QHash<QString, QString>& data);
+    bool offersUpdate() const;
     void tryNextMirror();
+    void finishCheck(bool succeeded);
+    void scheduleCheck(int delaySecs);
+    QNetworkAccessManager* networkManager();
+    void releaseNetworkManager();
+    void fetchPackage();
+    bool fetchPatches(const QString& version, const QString& fileName,
+                      const QByteArray& hash);
+    void fetchNextPatch();
+    void abandonPatches();
+    QString patchFileName(const BinaryPatch::Step& step) const;
+    bool startPackageDownload(const QUrl& url, const QString& fileName,
+                              const QByteArray& hash,
+                              const char* finishedSlot);
+    void stagePackage(const QString& version, const QString& fileName);
+    void discardStagedUpdate();
+    void discardBasePackage();
+    void keepPartialPackage(WallpaperDownload* download);
+    bool launchInstaller(const QString& arguments);
 };
 
 #endif
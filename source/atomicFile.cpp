@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "atomicFile.h"
+
+#ifdef Q_WS_WIN
+#include <windows.h>
+#include <io.h>
+#else
+#include <stdio.h>
+#include <unistd.h>
+#endif
+
+
+/*!
+ * Returns the name of the temporary file used while writing \a target
+ */
+QString AtomicFile::tempFileName(const QString& target)
+{
+  return target + ".part";
+}
+
+/*!
+ * Flushes \a file and asks the operating system to commit its contents to
+ * disk.
+ * \returns true on success
+ */
+bool AtomicFile::sync(QFile& file)
+{
+  if (!file.flush()) {
+    return false;
+  }
+#ifdef Q_WS_WIN
+  return _commit(file.handle()) == 0;
+#else
+  return fsync(file.handle()) == 0;
+#endif
+}
+
+/*!
+ * Renames \a source to \a target, replacing \a target if it exists.  Where the
+ * platform allows it the replacement is atomic, so \a target is either the old
+ * file or the new one, never missing or half-written.
+ * \returns true on success
+ */
+bool AtomicFile::replace(const QString& source, const QString& target)
+{
+#ifdef Q_WS_WIN
+  return MoveFileExW((const wchar_t*)QDir::toNativeSeparators(source).utf16(),
+                     (const wchar_t*)QDir::toNativeSeparators(target).utf16(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+  return rename(QFile::encodeName(source).constData(),
+                QFile::encodeName(target).constData()) == 0;
+#endif
+}
+
+/*!
+ * Writes \a data to \a target atomically
+ * \returns true on success
+ */
+bool AtomicFile::write(const QString& target, const QByteArray& data)
+{
+  QFile file(tempFileName(target));
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    return false;
+  }
+  bool ok = (file.write(data) == data.size()) && sync(file);
+  file.close();
+  if (ok) {
+    ok = replace(file.fileName(), target);
+  }
+  if (!ok) {
+    file.remove();
+  }
+  return ok;
+}
@@ -0,0 +1,258 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "binaryPatch.h"
+#include "atomicFile.h"
+#include "sha256.h"
+#include "versionNumber.h"
+
+namespace
+{
+  const char Magic[] = "LWUPATCH";
+  // Data is copied and inserted in slices of at most this many bytes
+  const int SliceSize = 64 * 1024;
+
+  /*!
+   * Returns the index of \a version in \a versions, adding it if need be
+   */
+  int node(QList<VersionNumber>* versions, const QString& version)
+  {
+    VersionNumber number(version);
+    for (int i = 0; i < versions->size(); i++) {
+      if (versions->at(i) == number) {
+        return i;
+      }
+    }
+    versions->append(number);
+    return versions->size() - 1;
+  }
+}
+
+
+/*!
+ * Picks out of the update file \a data the patches listed under keys of the
+ * form "<prefix>[<base version>]".  Entries that are incomplete are skipped.
+ */
+QList<BinaryPatch::Step> BinaryPatch::parse(
+  const QHash<QString, QString>& data, const QString& prefix)
+{
+  QList<Step> steps;
+  QHash<QString, QString>::const_iterator i;
+  for (i = data.constBegin(); i != data.constEnd(); ++i) {
+    const QString& key = i.key();
+    if (!key.startsWith(prefix + "[") || !key.endsWith("]")) {
+      continue;
+    }
+    QString from = key.mid(prefix.size() + 1,
+                           key.size() - prefix.size() - 2).trimmed();
+
+    foreach (QString entry, i.value().split(';', QString::SkipEmptyParts)) {
+      QStringList fields = entry.simplified().split(' ');
+      if (fields.size() != 4) {
+        continue;
+      }
+      Step step;
+      step.from = from;
+      step.to = fields[0];
+      step.size = fields[1].toLongLong();
+      step.hash = fields[2].toAscii().toLower();
+      step.url = QUrl(fields[3]);
+      if (!from.isEmpty() && step.size > 0 && step.hash.size() == 64 &&
+          step.url.isValid()) {
+        steps << step;
+      }
+    }
+  }
+  return steps;
+}
+
+/*!
+ * Finds the series of \a steps that leads from version \a from to version
+ * \a to with the fewest bytes to download, and sets \a cost to that number
+ * if given.
+ * \returns an empty chain if there is no way there
+ */
+BinaryPatch::Chain BinaryPatch::cheapestChain(const QList<Step>& steps,
+                                              const QString& from,
+                                              const QString& to,
+                                              qint64* cost)
+{
+  QList<VersionNumber> versions;
+  int start = node(&versions, from);
+  QVector<int> stepFrom;
+  QVector<int> stepTo;
+  foreach (const Step& step, steps) {
+    stepFrom << node(&versions, step.from);
+    stepTo << node(&versions, step.to);
+  }
+  int target = node(&versions, to);
+
+  // Dijkstra's algorithm; there are only ever a handful of patches, so the
+  // simplest form will do
+  QVector<qint64> distance(versions.size(), -1);
+  QVector<int> via(versions.size(), -1);
+  QVector<bool> done(versions.size(), false);
+  distance[start] = 0;
+  forever {
+    int current = -1;
+    for (int v = 0; v < versions.size(); v++) {
+      if (!done[v] && distance[v] >= 0 &&
+          (current < 0 || distance[v] < distance[current])) {
+        current = v;
+      }
+    }
+    if (current < 0 || current == target) {
+      break;
+    }
+    done[current] = true;
+
+    for (int s = 0; s < steps.size(); s++) {
+      if (stepFrom[s] != current) {
+        continue;
+      }
+      qint64 reached = distance[current] + steps[s].size;
+      int next = stepTo[s];
+      if (distance[next] < 0 || reached < distance[next]) {
+        distance[next] = reached;
+        via[next] = s;
+      }
+    }
+  }
+
+  Chain chain;
+  if (target == start || distance[target] < 0) {
+    return chain;
+  }
+  for (int v = target; v != start; v = stepFrom[via[v]]) {
+    chain.prepend(steps[via[v]]);
+  }
+  if (cost) {
+    *cost = distance[target];
+  }
+  return chain;
+}
+
+/*!
+ * Applies the \a patches one after another to the package \a base, writing
+ * the result to \a output.  The packages in between are written alongside
+ * \a output and removed as soon as they have been used.  Safe to run on a
+ * worker thread.
+ * \returns the SHA-256 hash of the result, in hex, or an empty array if
+ *          anything went wrong
+ */
+QByteArray BinaryPatch::apply(const QString& base, const QStringList& patches,
+                              const QString& output)
+{
+  QString input = base;
+  QByteArray hash;
+  for (int i = 0; i < patches.size(); i++) {
+    QString result = output;
+    if (i < patches.size() - 1) {
+      result += "." + QString::number(i);
+    }
+    bool ok = applyOne(input, patches[i], result, &hash);
+    if (input != base) {
+      QFile::remove(input);
+    }
+    if (!ok) {
+      QFile::remove(result);
+      return QByteArray();
+    }
+    input = result;
+  }
+  return hash;
+}
+
+/*!
+ * Applies the single \a patch to \a base, writing the result to \a output and
+ * setting \a hash to its SHA-256 hash in hex
+ * \returns false if either input is unreadable or damaged, or the output
+ *          couldn't be written
+ */
+bool BinaryPatch::applyOne(const QString& base, const QString& patch,
+                           const QString& output, QByteArray* hash)
+{
+  QFile baseFile(base);
+  QFile patchFile(patch);
+  QFile outputFile(output);
+  if (!baseFile.open(QIODevice::ReadOnly) ||
+      !patchFile.open(QIODevice::ReadOnly) ||
+      !outputFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    return false;
+  }
+  if (patchFile.read(sizeof(Magic) - 1) != Magic) {
+    return false;
+  }
+
+  QDataStream stream(&patchFile);
+  Sha256 sha256;
+  QByteArray slice;
+  forever {
+    quint8 op;
+    stream >> op;
+    if (stream.status() != QDataStream::Ok) {
+      return false;
+    }
+    if (op == 'E') {
+      break;
+    }
+
+    QIODevice* source;
+    quint64 offset = 0;
+    quint32 length;
+    if (op == 'C') {
+      stream >> offset >> length;
+      source = &baseFile;
+    } else if (op == 'I') {
+      stream >> length;
+      source = &patchFile;
+    } else {
+      return false;
+    }
+    if (stream.status() != QDataStream::Ok ||
+        (op == 'C' && (offset + length > (quint64)baseFile.size() ||
+                       !baseFile.seek(offset)))) {
+      return false;
+    }
+
+    while (length > 0) {
+      slice = source->read(qMin(length, (quint32)SliceSize));
+      if (slice.isEmpty()) {
+        return false;
+      }
+      length -= slice.size();
+      sha256.addData(slice);
+      if (outputFile.write(slice) != slice.size()) {
+        return false;
+      }
+    }
+  }
+
+  *hash = sha256.result().toHex();
+  return AtomicFile::sync(outputFile);
+}
@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BINARYPATCH_H
+#define BINARYPATCH_H
+
+#include <QtCore>
+
+
+/*!
+ * Binary patches that turn one version's installer package into the next, so
+ * that an upgrade need only download what has changed.
+ *
+ * The update file lists the patches available from each base version as
+ *
+ *   <prefix>[<base version>]: <version> <size> <SHA-256> <URL>; ...
+ *
+ * A patch file is a series of instructions for building the new package from
+ * the old one, with all integers big-endian:
+ *
+ *   "LWUPATCH"                              magic
+ *   'C' <quint64 offset> <quint32 length>   copy from the old package
+ *   'I' <quint32 length> <data>             insert new data
+ *   'E'                                     end of patch
+ *
+ * Patches are applied a slice at a time, so memory use doesn't grow with the
+ * size of the package.
+ */
+class BinaryPatch
+{
+  public:
+    struct Step
+    {
+      Step() : size(0) {}
+
+      QString from;
+      QString to;
+      QUrl url;
+      qint64 size;
+      QByteArray hash;
+    };
+    typedef QList<Step> Chain;
+
+    static QList<Step> parse(const QHash<QString, QString>& data,
+                             const QString& prefix);
+    static Chain cheapestChain(const QList<Step>& steps, const QString& from,
+                               const QString& to, qint64* cost = 0);
+    static QByteArray apply(const QString& base, const QStringList& patches,
+                            const QString& output);
+
+  private:
+    static bool applyOne(const QString& base, const QString& patch,
+                         const QString& output, QByteArray* hash);
+};
+
+#endif
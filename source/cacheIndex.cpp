@@ -0,0 +1,246 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "cacheIndex.h"
+#include "atomicFile.h"
+#include "lockFile.h"
+#include "diskQueue.h"
+
+namespace
+{
+  // How long to wait for another process to finish changing the index
+  const int LockTimeoutMsecs = 5000;
+}
+
+
+/*!
+ * Name of the index file within the cache directory
+ */
+const char* const CacheIndex::IndexFileName = "index.txt";
+
+/*!
+ * Constructor; reads the index from \a fileName if it exists
+ */
+CacheIndex::CacheIndex(const QString& fileName)
+  : mFileName(fileName),
+    mShared(false),
+    mDiskQueue(NULL),
+    mEntries(),
+    mLoadedModified(),
+    mLoadedSize(-1)
+{
+  load();
+}
+
+/*!
+ * Destructor
+ */
+CacheIndex::~CacheIndex()
+{
+}
+
+/*!
+ * Returns the entry for the cached file \a name, or an invalid entry if we
+ * know nothing about it
+ */
+CacheIndex::Entry CacheIndex::entry(const QString& name) const
+{
+  refresh();
+  return mEntries.value(name);
+}
+
+/*!
+ * Returns the names of all the files we know about
+ */
+QStringList CacheIndex::names() const
+{
+  refresh();
+  return mEntries.keys();
+}
+
+/*!
+ * Records \a entry for the cached file \a name
+ * \returns false if the index could not be written
+ */
+bool CacheIndex::setEntry(const QString& name, const Entry& entry)
+{
+  LockFile lock(mFileName + ".lock");
+  if (!beginUpdate(lock)) {
+    return false;
+  }
+  mEntries.insert(name, entry);
+  return save();
+}
+
+/*!
+ * Forgets about the cached file \a name
+ * \returns false if the index could not be written
+ */
+bool CacheIndex::removeEntry(const QString& name)
+{
+  LockFile lock(mFileName + ".lock");
+  if (!beginUpdate(lock)) {
+    return false;
+  }
+  if (mEntries.remove(name) == 0) {
+    return true;
+  }
+  return save();
+}
+
+/*!
+ * Forgets about all cached files
+ * \returns false if the index could not be written
+ */
+bool CacheIndex::clear()
+{
+  LockFile lock(mFileName + ".lock");
+  if (!beginUpdate(lock)) {
+    return false;
+  }
+  mEntries.clear();
+  return save();
+}
+
+/*!
+ * Rereads a shared index if another process has changed it since we last
+ * read or wrote it.  Modification times may be too coarse to show two
+ * changes in quick succession, so the size is compared as well.
+ */
+void CacheIndex::refresh() const
+{
+  if (!mShared) {
+    return;
+  }
+  QFileInfo info(mFileName);
+  if (info.lastModified() != mLoadedModified || info.size() != mLoadedSize) {
+    load();
+  }
+}
+
+/*!
+ * Prepares to change the index.  A shared index is locked with \a lock and
+ * reread, so that changes made by other processes aren't lost when we save.
+ * \returns false if the lock could not be taken
+ */
+bool CacheIndex::beginUpdate(LockFile& lock)
+{
+  if (!mShared) {
+    return true;
+  }
+  if (!lock.lock(LockTimeoutMsecs)) {
+    return false;
+  }
+  load();
+  return true;
+}
+
+/*!
+ * Reads the index file.  Each line describes one cached file as tab-separated
+ * fields: name, ETag, Last-Modified, size, hash, month, year, resolution, time
+ * last used, time last checked with the server and the comma-separated users
+ * showing the file.  Lines that can't be understood are skipped; the worst
+ * that can happen is an extra download.
+ */
+void CacheIndex::load() const
+{
+  mEntries.clear();
+  QFileInfo info(mFileName);
+  mLoadedModified = info.lastModified();
+  mLoadedSize = info.size();
+  QFile file(mFileName);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return;
+  }
+
+  while (!file.atEnd()) {
+    QByteArray line = file.readLine();
+    while (line.endsWith('\n') || line.endsWith('\r')) {
+      line.chop(1);
+    }
+    QList<QByteArray> fields = line.split('\t');
+    if (fields.size() < 5) {
+      continue;
+    }
+    Entry entry;
+    entry.eTag = fields[1];
+    entry.lastModified = fields[2];
+    bool isInt;
+    entry.size = fields[3].toLongLong(&isInt);
+    entry.hash = fields[4];
+    // (Older indexes stop here)
+    if (fields.size() >= 9) {
+      entry.month = fields[5].toInt();
+      entry.year = fields[6].toInt();
+      entry.resolution = fields[7];
+      entry.lastUsed = fields[8].toUInt();
+    }
+    if (fields.size() >= 10) {
+      entry.checked = fields[9].toUInt();
+    }
+    if (fields.size() >= 11) {
+      entry.pinnedBy = fields[10];
+    }
+    if (isInt && entry.size >= 0) {
+      mEntries.insert(QString::fromUtf8(fields[0]), entry);
+    }
+  }
+}
+
+/*!
+ * Writes the index file
+ */
+bool CacheIndex::save()
+{
+  QByteArray data;
+  QMapIterator<QString, Entry> i(mEntries);
+  while (i.hasNext()) {
+    i.next();
+    const Entry& entry = i.value();
+    data += i.key().toUtf8() + '\t' + entry.eTag + '\t' + entry.lastModified +
+            '\t' + QByteArray::number(entry.size) + '\t' + entry.hash +
+            '\t' + QByteArray::number(entry.month) +
+            '\t' + QByteArray::number(entry.year) +
+            '\t' + entry.resolution +
+            '\t' + QByteArray::number(entry.lastUsed) +
+            '\t' + QByteArray::number(entry.checked) +
+            '\t' + entry.pinnedBy + '\n';
+  }
+
+  // Other processes reading a shared index must see each change as soon as
+  // the lock is released, so only a private one can be written later
+  if (mDiskQueue && !mShared) {
+    mDiskQueue->writeFile(mFileName, data);
+    return true;
+  }
+  bool ok = AtomicFile::write(mFileName, data);
+  QFileInfo info(mFileName);
+  mLoadedModified = info.lastModified();
+  mLoadedSize = info.size();
+  return ok;
+}
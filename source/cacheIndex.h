@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CACHEINDEX_H
+#define CACHEINDEX_H
+
+#include <QtCore>
+
+class LockFile;
+class DiskQueue;
+
+
+/*!
+ * Persistent record of what we know about each file in the wallpaper cache:
+ * the HTTP validators the server sent with it, its size, a hash of its
+ * contents, which wallpaper it is, when it was last used, when the server
+ * last confirmed it was current and which users have it on their desktops.
+ * The index lives
+ * in a small text file alongside the cached files, and is rewritten atomically
+ * whenever it changes.
+ *
+ * Given a disk queue, an index that isn't shared is written in the
+ * background, and the copy in memory is the one that counts.
+ *
+ * A shared index may be changed by several processes at once.  Each change
+ * is then made under a lock, on a fresh copy of the file, and the file is
+ * reread whenever another process has changed it.
+ */
+class CacheIndex
+{
+  public:
+    struct Entry
+    {
+      Entry() : size(-1), month(0), year(0), lastUsed(0), checked(0) {}
+      bool isValid() const { return size >= 0; }
+
+      QByteArray eTag;
+      QByteArray lastModified;
+      qint64 size;
+      QByteArray hash;
+      int month;
+      int year;
+      QByteArray resolution;
+      uint lastUsed;
+      uint checked;
+      QByteArray pinnedBy;
+    };
+
+    explicit CacheIndex(const QString& fileName);
+    ~CacheIndex();
+    static const char* const IndexFileName;
+    void setShared(bool shared) { mShared = shared; }
+    void setDiskQueue(DiskQueue* queue) { mDiskQueue = queue; }
+    Entry entry(const QString& name) const;
+    QStringList names() const;
+    bool setEntry(const QString& name, const Entry& entry);
+    bool removeEntry(const QString& name);
+    bool clear();
+
+  private:
+    const QString mFileName;
+    bool mShared;
+    DiskQueue* mDiskQueue;
+    mutable QMap<QString, Entry> mEntries;
+    mutable QDateTime mLoadedModified;
+    mutable qint64 mLoadedSize;
+
+    void refresh() const;
+    bool beginUpdate(LockFile& lock);
+    void load() const;
+    bool save();
+};
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "checksumManifest.h"
+
+
+/*!
+ * Name of the manifest, both on the server and in the cache directory
+ */
+const char* const ChecksumManifest::FileName = "SHA256SUMS";
+
+/*!
+ * Constructor
+ */
+ChecksumManifest::ChecksumManifest()
+  : mHashes()
+{
+}
+
+/*!
+ * Destructor
+ */
+ChecksumManifest::~ChecksumManifest()
+{
+}
+
+/*!
+ * Replaces our checksums with those listed in \a fileName.  Lines that can't
+ * be understood are skipped.
+ * \returns false if the file could not be read, in which case we are left
+ *          with no checksums
+ */
+bool ChecksumManifest::load(const QString& fileName)
+{
+  mHashes.clear();
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+
+  QRegExp hexDigits("[0-9a-fA-F]{64}");
+  while (!file.atEnd()) {
+    QByteArray line = file.readLine();
+    while (line.endsWith('\n') || line.endsWith('\r')) {
+      line.chop(1);
+    }
+    if (line.size() < 67 || line[64] != ' ' ||
+        (line[65] != ' ' && line[65] != '*') ||
+        !hexDigits.exactMatch(QString::fromLatin1(line.left(64)))) {
+      continue;
+    }
+    mHashes.insert(QString::fromUtf8(line.mid(66)), line.left(64).toLower());
+  }
+  return true;
+}
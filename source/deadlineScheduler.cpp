@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deadlineScheduler.moc"
+
+namespace
+{
+  // We never sleep longer than this before checking the clock again, in
+  // case it has changed without our hearing about it
+  const int MaxSleepSecs = 6 * 60 * 60;
+}
+
+
+/**
+ * Constructor
+ */
+DeadlineScheduler::DeadlineScheduler(QObject* parent)
+  : QObject(parent),
+    mDeadlines(),
+    mTimer()
+{
+  mTimer.setSingleShot(true);
+  connect(&mTimer, SIGNAL(timeout()), this, SLOT(timeout()));
+}
+
+/**
+ * Destructor
+ */
+DeadlineScheduler::~DeadlineScheduler()
+{
+}
+
+/**
+ * Arranges for the given slot to be called at the given time, replacing any
+ * deadline already set for it.  A time in the past is due straight away.
+ * @param receiver Object to call the slot on
+ * @param slot Name of the slot, without arguments
+ * @param when When to call it
+ */
+void DeadlineScheduler::schedule(QObject* receiver, const char* slot,
+                                 const QDateTime& when)
+{
+  int index = indexOf(receiver, slot);
+  if (index < 0) {
+    Deadline deadline;
+    deadline.receiver = receiver;
+    deadline.slot = slot;
+    mDeadlines << deadline;
+    index = mDeadlines.size() - 1;
+  }
+  mDeadlines[index].when = when;
+  rearm();
+}
+
+/**
+ * Forgets the deadline for the given slot, if there is one
+ */
+void DeadlineScheduler::cancel(QObject* receiver, const char* slot)
+{
+  int index = indexOf(receiver, slot);
+  if (index >= 0) {
+    mDeadlines.removeAt(index);
+    rearm();
+  }
+}
+
+/**
+ * Returns when the given slot is due to be called, or a null time if it
+ * isn't
+ */
+QDateTime DeadlineScheduler::deadline(QObject* receiver,
+                                      const char* slot) const
+{
+  int index = indexOf(receiver, slot);
+  return (index >= 0) ? mDeadlines[index].when : QDateTime();
+}
+
+/**
+ * Sets the timer for the earliest deadline, measured from the clock as it
+ * stands now.  If nothing is due, the timer is left off.
+ */
+void DeadlineScheduler::rearm()
+{
+  mTimer.stop();
+
+  QDateTime earliest;
+  for (int i = mDeadlines.size() - 1; i >= 0; i--) {
+    if (!mDeadlines[i].receiver) {
+      mDeadlines.removeAt(i);
+    } else if (!earliest.isValid() || mDeadlines[i].when < earliest) {
+      earliest = mDeadlines[i].when;
+    }
+  }
+  if (!earliest.isValid()) {
+    return;
+  }
+
+  // Whole seconds are counted down, so a deadline a fraction of a second
+  // away would otherwise have the timer fire early, and go on firing early
+  // until the deadline passed.  Rounding up, we may be a second late.
+  QDateTime now = QDateTime::currentDateTime();
+  int sleepSecs = 0;
+  if (earliest > now) {
+    sleepSecs = now.secsTo(earliest) + 1;
+  }
+  mTimer.start(qMin(sleepSecs, MaxSleepSecs) * 1000);
+}
+
+/**
+ * Called by the timer; calls the slots of every deadline that has passed
+ */
+void DeadlineScheduler::timeout()
+{
+  QDateTime now = QDateTime::currentDateTime();
+  QList<Deadline> due;
+  for (int i = mDeadlines.size() - 1; i >= 0; i--) {
+    if (mDeadlines[i].when <= now) {
+      due << mDeadlines.takeAt(i);
+    }
+  }
+
+  // Slots are called after they are removed, so that they may schedule
+  // themselves again
+  foreach (const Deadline& deadline, due) {
+    if (deadline.receiver) {
+      QMetaObject::invokeMethod(deadline.receiver, deadline.slot.constData());
+    }
+  }
+  rearm();
+}
+
+/**
+ * Returns the position of the deadline for the given slot, or -1
+ */
+int DeadlineScheduler::indexOf(QObject* receiver, const char* slot) const
+{
+  for (int i = 0; i < mDeadlines.size(); i++) {
+    if (mDeadlines[i].receiver == receiver && mDeadlines[i].slot == slot) {
+      return i;
+    }
+  }
+  return -1;
+}
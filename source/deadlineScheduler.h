@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DEADLINESCHEDULER_H
+#define DEADLINESCHEDULER_H
+
+#include <QtCore>
+
+
+/**
+ * Keeps the wall-clock times at which parts of the application next have
+ * something to do, and arms a single timer for the earliest of them, so that
+ * the process doesn't wake up when there's nothing due.  Each deadline calls
+ * a slot on its receiver, which may schedule it again.  Timers measure
+ * elapsed time rather than the clock, so rearm() should be called after the
+ * clock is changed or the system resumes; in case that goes unnoticed, the
+ * timer never sleeps for longer than a few hours at a time.
+ */
+class DeadlineScheduler : public QObject
+{
+  Q_OBJECT
+
+  public:
+    DeadlineScheduler(QObject* parent = 0);
+    ~DeadlineScheduler();
+    void schedule(QObject* receiver, const char* slot, const QDateTime& when);
+    void cancel(QObject* receiver, const char* slot);
+    QDateTime deadline(QObject* receiver, const char* slot) const;
+
+  public slots:
+    void rearm();
+
+  private slots:
+    void timeout();
+
+  private:
+    struct Deadline
+    {
+      QPointer<QObject> receiver;
+      QByteArray slot;
+      QDateTime when;
+    };
+
+    QList<Deadline> mDeadlines;
+    QTimer mTimer;
+
+    int indexOf(QObject* receiver, const char* slot) const;
+};
+
+#endif
@@ -28,6 +28,7 @@
 
 #define APP_NAME "@APP_LONGNAME@"
 #define APP_VERSION "@APP_VERSION@"
+#cmakedefine HAVE_LIBJPEG
 
 #ifdef Q_WS_X11
 #define UNIX 1
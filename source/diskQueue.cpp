@@ -0,0 +1,297 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "diskQueue.moc"
+#include "atomicFile.h"
+
+namespace
+{
+  const char* const OperationNames[] = {
+    "write", "commit", "remove", "clear", "mkpath"
+  };
+
+  // Each histogram bucket holds the operations that took less than its
+  // limit (and at least the previous one's); the last holds the rest
+  const int BucketLimitMsecs[] = { 1, 4, 16, 64, 256, 1024, 4096 };
+
+  // Operations taking at least this long are logged as they happen
+  const int SlowMsecs = 250;
+
+  // How often the histograms are saved, at most, so that they survive the
+  // session ending without our being shut down cleanly
+  const int SaveIntervalMsecs = 5 * 60 * 1000;
+}
+
+
+/**
+ * Constructor
+ */
+DiskQueue::DiskQueue(QObject* parent)
+  : QObject(parent),
+    mMutex(),
+    mSinceSaved()
+{
+  for (int i = 0; i < OperationCount; i++) {
+    for (int j = 0; j < BucketCount; j++) {
+      mHistograms[i][j] = 0;
+    }
+  }
+  load();
+  mSinceSaved.start();
+}
+
+/**
+ * Destructor
+ */
+DiskQueue::~DiskQueue()
+{
+  save();
+}
+
+/**
+ * Writes \a data to \a fileName atomically, then emits fileWritten()
+ */
+void DiskQueue::writeFile(const QString& fileName, const QByteArray& data)
+{
+  QMetaObject::invokeMethod(this, "doWriteFile", Qt::QueuedConnection,
+                            Q_ARG(QString, fileName), Q_ARG(QByteArray, data));
+}
+
+/**
+ * Commits the finished download in \a partFileName to disk and renames it
+ * over \a fileName, then emits fileCommitted()
+ */
+void DiskQueue::commitFile(const QString& partFileName,
+                           const QString& fileName)
+{
+  QMetaObject::invokeMethod(this, "doCommitFile", Qt::QueuedConnection,
+                            Q_ARG(QString, partFileName),
+                            Q_ARG(QString, fileName));
+}
+
+/**
+ * Deletes the given files, then emits filesRemoved()
+ */
+void DiskQueue::removeFiles(const QStringList& fileNames)
+{
+  QMetaObject::invokeMethod(this, "doRemoveFiles", Qt::QueuedConnection,
+                            Q_ARG(QStringList, fileNames));
+}
+
+/**
+ * Deletes every file in the directory \a path, except those named in
+ * \a keep and any locks, then emits filesRemoved()
+ */
+void DiskQueue::clearDirectory(const QString& path, const QStringList& keep)
+{
+  QMetaObject::invokeMethod(this, "doClearDirectory", Qt::QueuedConnection,
+                            Q_ARG(QString, path), Q_ARG(QStringList, keep));
+}
+
+/**
+ * Creates the directory \a path and any parents, then emits pathMade()
+ */
+void DiskQueue::makePath(const QString& path)
+{
+  QMetaObject::invokeMethod(this, "doMakePath", Qt::QueuedConnection,
+                            Q_ARG(QString, path));
+}
+
+/**
+ * Waits until everything asked for so far has been done.  Must not be
+ * called from the queue's own thread.
+ */
+void DiskQueue::waitForIdle()
+{
+  QMetaObject::invokeMethod(this, "idle", Qt::BlockingQueuedConnection);
+}
+
+/**
+ * Returns a summary of how long each kind of operation has taken: for each,
+ * the number that fell into each bucket, with the buckets' upper limits
+ */
+QString DiskQueue::report() const
+{
+  QMutexLocker locker(&mMutex);
+  QStringList lines;
+  for (int i = 0; i < OperationCount; i++) {
+    QStringList buckets;
+    for (int j = 0; j < BucketCount; j++) {
+      QString limit = (j < BucketCount - 1) ?
+                        QString("<%1ms").arg(BucketLimitMsecs[j]) :
+                        QString(">=%1ms").arg(BucketLimitMsecs[j - 1]);
+      buckets << QString("%1 %2").arg(limit).arg(mHistograms[i][j]);
+    }
+    lines << QString("%1: %2").arg(OperationNames[i]).
+               arg(buckets.join(", "));
+  }
+  return lines.join("\n");
+}
+
+/**
+ * Does the work of writeFile()
+ */
+void DiskQueue::doWriteFile(const QString& fileName, const QByteArray& data)
+{
+  QTime clock;
+  clock.start();
+  bool ok = AtomicFile::write(fileName, data);
+  record(Write, clock.elapsed());
+  emit fileWritten(fileName, ok);
+}
+
+/**
+ * Does the work of commitFile()
+ */
+void DiskQueue::doCommitFile(const QString& partFileName,
+                             const QString& fileName)
+{
+  QTime clock;
+  clock.start();
+  QFile file(partFileName);
+  bool ok = file.open(QIODevice::ReadWrite) && AtomicFile::sync(file);
+  file.close();
+  ok = ok && AtomicFile::replace(partFileName, fileName);
+  record(Commit, clock.elapsed());
+  emit fileCommitted(fileName, ok);
+}
+
+/**
+ * Does the work of removeFiles()
+ */
+void DiskQueue::doRemoveFiles(const QStringList& fileNames)
+{
+  QTime clock;
+  clock.start();
+  bool ok = true;
+  foreach (QString fileName, fileNames) {
+    ok = (QFile::remove(fileName) || !QFile::exists(fileName)) && ok;
+  }
+  record(Remove, clock.elapsed());
+  emit filesRemoved(fileNames, ok);
+}
+
+/**
+ * Does the work of clearDirectory()
+ */
+void DiskQueue::doClearDirectory(const QString& path, const QStringList& keep)
+{
+  QTime clock;
+  clock.start();
+  QDir dir(path);
+  QStringList removed;
+  bool ok = true;
+  // (This list will just be empty if the directory doesn't exist)
+  foreach (QString entry, dir.entryList(QDir::Files)) {
+    // Locks belong to whoever holds them, which may be another process
+    if (keep.contains(entry) || entry.endsWith(".lock")) {
+      continue;
+    }
+    ok = dir.remove(entry) && ok;
+    removed << dir.filePath(entry);
+  }
+  record(Clear, clock.elapsed());
+  emit filesRemoved(removed, ok);
+}
+
+/**
+ * Does the work of makePath()
+ */
+void DiskQueue::doMakePath(const QString& path)
+{
+  QTime clock;
+  clock.start();
+  bool ok = QDir().mkpath(path);
+  record(MakePath, clock.elapsed());
+  emit pathMade(path, ok);
+}
+
+/**
+ * Does nothing; see waitForIdle()
+ */
+void DiskQueue::idle()
+{
+}
+
+/**
+ * Adds an operation that took \a msecs to its histogram
+ */
+void DiskQueue::record(Operation operation, int msecs)
+{
+  int bucket = 0;
+  while (bucket < BucketCount - 1 && msecs >= BucketLimitMsecs[bucket]) {
+    bucket++;
+  }
+  QMutexLocker locker(&mMutex);
+  mHistograms[operation][bucket]++;
+
+  if (msecs >= SlowMsecs) {
+    qDebug() << "Slow disk operation:" << OperationNames[operation] <<
+                "took" << msecs << "ms";
+  }
+
+  if (mSinceSaved.elapsed() >= SaveIntervalMsecs) {
+    mSinceSaved.restart();
+    locker.unlock();
+    save();
+  }
+}
+
+/**
+ * Loads the histograms kept from earlier runs
+ */
+void DiskQueue::load()
+{
+  QSettings settings;
+  settings.beginGroup("diskLatency");
+  for (int i = 0; i < OperationCount; i++) {
+    QStringList counts = settings.value(OperationNames[i]).toStringList();
+    for (int j = 0; j < BucketCount && j < counts.size(); j++) {
+      mHistograms[i][j] = counts[j].toLongLong();
+    }
+  }
+  settings.endGroup();
+}
+
+/**
+ * Stores the histograms for next time
+ */
+void DiskQueue::save() const
+{
+  QMutexLocker locker(&mMutex);
+  QSettings settings;
+  settings.beginGroup("diskLatency");
+  for (int i = 0; i < OperationCount; i++) {
+    QStringList counts;
+    for (int j = 0; j < BucketCount; j++) {
+      counts << QString::number(mHistograms[i][j]);
+    }
+    settings.setValue(OperationNames[i], counts);
+  }
+  settings.endGroup();
+}
@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DISKQUEUE_H
+#define DISKQUEUE_H
+
+#include <QtCore>
+
+
+/**
+ * Carries out slow file operations on the wallpaper cache one after another
+ * on a worker thread, so that the tray doesn't freeze when the cache is on
+ * a roaming profile or a network drive.  Meant to be moved to a thread of
+ * its own; the public functions may be called from any other thread, and
+ * report back through signals, which arrive queued.
+ *
+ * How long each kind of operation takes is recorded in a histogram, so that
+ * slow storage shows up in report() and in the settings, which are brought
+ * up to date every few minutes while the queue is in use.
+ */
+class DiskQueue : public QObject
+{
+  Q_OBJECT
+
+  public:
+    DiskQueue(QObject* parent = 0);
+    ~DiskQueue();
+    void writeFile(const QString& fileName, const QByteArray& data);
+    void commitFile(const QString& partFileName, const QString& fileName);
+    void removeFiles(const QStringList& fileNames);
+    void clearDirectory(const QString& path, const QStringList& keep);
+    void makePath(const QString& path);
+    void waitForIdle();
+    QString report() const;
+
+  signals:
+    void fileWritten(const QString& fileName, bool succeeded);
+    void fileCommitted(const QString& fileName, bool succeeded);
+    void filesRemoved(const QStringList& fileNames, bool succeeded);
+    void pathMade(const QString& path, bool succeeded);
+
+  private slots:
+    void doWriteFile(const QString& fileName, const QByteArray& data);
+    void doCommitFile(const QString& partFileName, const QString& fileName);
+    void doRemoveFiles(const QStringList& fileNames);
+    void doClearDirectory(const QString& path, const QStringList& keep);
+    void doMakePath(const QString& path);
+    void idle();
+
+  private:
+    enum Operation { Write, Commit, Remove, Clear, MakePath,
+                     OperationCount };
+    enum { BucketCount = 8 };
+
+    mutable QMutex mMutex;
+    qint64 mHistograms[OperationCount][BucketCount];
+    QTime mSinceSaved;
+
+    void record(Operation operation, int msecs);
+    void load();
+    void save() const;
+};
+
+#endif
@@ -0,0 +1,172 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "imagePipeline.moc"
+#include "resampler.h"
+#include "atomicFile.h"
+
+
+/**
+ * Constructor
+ */
+ImagePipeline::ImagePipeline(QObject* parent)
+  : QObject(parent),
+    mWatcher(),
+    mPending(),
+    mHavePending(false)
+{
+  connect(&mWatcher, SIGNAL(finished()), this, SLOT(batchFinished()));
+}
+
+/**
+ * Destructor; waits for any running batch, since it writes into the cache
+ */
+ImagePipeline::~ImagePipeline()
+{
+  mWatcher.waitForFinished();
+}
+
+/**
+ * Starts processing \a tasks on a worker thread
+ */
+void ImagePipeline::process(const TaskList& tasks)
+{
+  if (mWatcher.isRunning()) {
+    mPending = tasks;
+    mHavePending = true;
+    return;
+  }
+  mWatcher.setFuture(QtConcurrent::run(&ImagePipeline::run, tasks));
+}
+
+/**
+ * Called on our own thread when the worker has finished a batch
+ */
+void ImagePipeline::batchFinished()
+{
+  TaskList tasks = mWatcher.result();
+
+  if (mHavePending) {
+    mHavePending = false;
+    mWatcher.setFuture(QtConcurrent::run(&ImagePipeline::run, mPending));
+    mPending.clear();
+  }
+
+  emit finished(tasks);
+}
+
+/**
+ * Processes a batch of tasks.  Runs on a worker thread, so it must not touch
+ * anything but its arguments.  Outputs already written earlier in the batch
+ * are not written again.
+ */
+ImagePipeline::TaskList ImagePipeline::run(TaskList tasks)
+{
+  QHash<QString, QString> written;
+
+  for (int i = 0; i < tasks.size(); i++) {
+    Task& task = tasks[i];
+    task.result = task.source;
+    task.ok = true;
+
+    QString key = task.fittedOutput + '\n' + task.bmpOutput;
+    if (written.contains(key)) {
+      task.result = written[key];
+      continue;
+    }
+
+    bool fit = task.size.isValid() && !task.fittedOutput.isEmpty();
+    if (!fit && task.bmpOutput.isEmpty()) {
+      continue;
+    }
+
+    QImage image = task.image.isNull() ? load(task.source) : task.image;
+    task.image = QImage();
+    if (image.isNull()) {
+      task.ok = false;
+      continue;
+    }
+
+    if (fit && image.size() != task.size) {
+      image = Resampler::fit(image, task.size);
+      if (save(image, task.fittedOutput, "JPEG")) {
+        task.result = task.fittedOutput;
+      } else {
+        task.ok = false;
+      }
+    }
+
+    if (!task.bmpOutput.isEmpty()) {
+      if (save(image, task.bmpOutput, "BMP")) {
+        task.result = task.bmpOutput;
+      } else {
+        task.ok = false;
+      }
+    }
+
+    written.insert(key, task.result);
+  }
+
+  return tasks;
+}
+
+/**
+ * Decodes an image straight from a memory mapping of the file, so that the
+ * compressed data isn't copied into memory first
+ */
+QImage ImagePipeline::load(const QString& fileName)
+{
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return QImage();
+  }
+
+  uchar* data = file.map(0, file.size());
+  if (!data) {
+    // Not all file systems support mapping; fall back to reading
+    return QImage::fromData(file.readAll());
+  }
+  QImage image = QImage::fromData(data, file.size());
+  file.unmap(data);
+  return image;
+}
+
+/**
+ * Encodes \a image into \a fileName atomically
+ */
+bool ImagePipeline::save(const QImage& image, const QString& fileName,
+                         const char* format)
+{
+  QString tempFileName = AtomicFile::tempFileName(fileName);
+  if (!image.save(tempFileName, format, 95) ||
+      !AtomicFile::replace(tempFileName, fileName)) {
+    QFile::remove(tempFileName);
+    return false;
+  }
+  return true;
+}
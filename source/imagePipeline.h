@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IMAGEPIPELINE_H
+#define IMAGEPIPELINE_H
+
+#include <QtGui>
+
+
+/**
+ * Runs the expensive image work (decoding, fitting to the screen, and
+ * re-encoding) on a worker thread, so that the tray stays responsive.  Each
+ * batch of tasks is processed in order, and finished() is emitted on the
+ * thread that owns the pipeline when the batch is done.  If a new batch is
+ * submitted while one is running, it replaces any batch still waiting.
+ */
+class ImagePipeline : public QObject
+{
+  Q_OBJECT
+
+  public:
+    struct Task
+    {
+      Task() : ok(false) {}
+
+      // For the caller's use; the pipeline ignores it
+      QString key;
+      // Image to start from, and optionally that image already decoded
+      QString source;
+      QImage image;
+      // If valid, the image is fitted to this size and saved as a JPEG here
+      QSize size;
+      QString fittedOutput;
+      // If set, the image is also saved here as a BMP
+      QString bmpOutput;
+      // Set by the worker: the file to hand to the desktop, and whether all
+      // requested outputs were written
+      QString result;
+      bool ok;
+    };
+    typedef QList<Task> TaskList;
+
+    ImagePipeline(QObject* parent = 0);
+    ~ImagePipeline();
+    void process(const TaskList& tasks);
+
+  signals:
+    void finished(const ImagePipeline::TaskList& tasks);
+
+  private slots:
+    void batchFinished();
+
+  private:
+    QFutureWatcher<TaskList> mWatcher;
+    TaskList mPending;
+    bool mHavePending;
+
+    static TaskList run(TaskList tasks);
+    static QImage load(const QString& fileName);
+    static bool save(const QImage& image, const QString& fileName,
+                     const char* format);
+};
+
+#endif
@@ -93,7 +93,7 @@ bool InstanceManager::ensureSingleInstance(ResolutionScheme scheme)
       socket.waitForReadyRead();
       QString remoteVersion = stream.readLine();
 
-      if (VersionNumber(remoteVersion) < VersionNumber(APP_VERSION)) {
+      if (VersionNumber(remoteVersion) < VersionNumber::application()) {
         tellServerToQuit(&socket);
         startServer();
       } else {
@@ -164,6 +164,7 @@ void InstanceManager::serverReadyRead(QObject* socketObject)
   while (!stream.atEnd()) {
     QString line = stream.readLine();
     if (line == "quit") {
+      emit handingOver();
       mServer->close();
       stream << "ok\n";
       stream.flush();
@@ -42,6 +42,9 @@ class InstanceManager : public QObject
     enum ResolutionScheme { HighestVersionWins, ThisInstanceWins };
     bool ensureSingleInstance(ResolutionScheme scheme = HighestVersionWins);
 
+  signals:
+    void handingOver();
+
   private slots:
     void serverConnection();
     void serverReadyRead(QObject* socketObject);
@@ -0,0 +1,298 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "jpegStreamDecoder.moc"
+#include "defines.h"
+
+#ifdef HAVE_LIBJPEG
+#include <stdio.h>
+#include <setjmp.h>
+extern "C" {
+#include <jpeglib.h>
+}
+
+namespace
+{
+  /**
+   * Error manager that jumps back to the decoder rather than exiting
+   */
+  struct ErrorManager
+  {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+  };
+
+  void errorExit(j_common_ptr cinfo)
+  {
+    longjmp(((ErrorManager*)cinfo->err)->jump, 1);
+  }
+
+  void outputMessage(j_common_ptr)
+  {
+  }
+
+  /**
+   * Source manager that never blocks: when it runs out of data, libjpeg
+   * suspends, and carries on from the same point once more data is added
+   */
+  struct SourceManager
+  {
+    jpeg_source_mgr pub;
+    // Bytes libjpeg has asked to skip that haven't arrived yet
+    size_t pendingSkip;
+  };
+
+  void initSource(j_decompress_ptr)
+  {
+  }
+
+  boolean fillInputBuffer(j_decompress_ptr)
+  {
+    return FALSE;
+  }
+
+  void skipInputData(j_decompress_ptr cinfo, long count)
+  {
+    SourceManager* source = (SourceManager*)cinfo->src;
+    if (count <= 0) {
+      return;
+    }
+    if ((size_t)count > source->pub.bytes_in_buffer) {
+      source->pendingSkip += count - source->pub.bytes_in_buffer;
+      source->pub.next_input_byte += source->pub.bytes_in_buffer;
+      source->pub.bytes_in_buffer = 0;
+    } else {
+      source->pub.next_input_byte += count;
+      source->pub.bytes_in_buffer -= count;
+    }
+  }
+
+  void termSource(j_decompress_ptr)
+  {
+  }
+}
+
+struct JpegStreamDecoder::Private
+{
+  enum State { ReadingHeader, Starting, ReadingScanlines, Finishing, Done,
+               Failed };
+
+  jpeg_decompress_struct cinfo;
+  ErrorManager error;
+  SourceManager source;
+  State state;
+  QByteArray buffer;
+  QVector<JSAMPLE> row;
+  QImage image;
+
+  Private();
+  ~Private();
+  void addData(const QByteArray& data);
+  void decode();
+  void convertRow(int y);
+};
+
+/**
+ * Sets up libjpeg to read from our buffer
+ */
+JpegStreamDecoder::Private::Private()
+  : state(ReadingHeader)
+{
+  cinfo.err = jpeg_std_error(&error.pub);
+  error.pub.error_exit = errorExit;
+  error.pub.output_message = outputMessage;
+  jpeg_create_decompress(&cinfo);
+
+  source.pub.init_source = initSource;
+  source.pub.fill_input_buffer = fillInputBuffer;
+  source.pub.skip_input_data = skipInputData;
+  source.pub.resync_to_restart = jpeg_resync_to_restart;
+  source.pub.term_source = termSource;
+  source.pub.next_input_byte = NULL;
+  source.pub.bytes_in_buffer = 0;
+  source.pendingSkip = 0;
+  cinfo.src = &source.pub;
+}
+
+JpegStreamDecoder::Private::~Private()
+{
+  jpeg_destroy_decompress(&cinfo);
+}
+
+/**
+ * Appends \a data to whatever libjpeg hasn't consumed yet, and decodes as far
+ * as it allows
+ */
+void JpegStreamDecoder::Private::addData(const QByteArray& data)
+{
+  if (state == Done || state == Failed) {
+    return;
+  }
+
+  int consumed = buffer.size() - (int)source.pub.bytes_in_buffer;
+  buffer.remove(0, consumed);
+  buffer.append(data);
+
+  int skip = (int)qMin(source.pendingSkip, (size_t)buffer.size());
+  buffer.remove(0, skip);
+  source.pendingSkip -= skip;
+
+  source.pub.next_input_byte = (const JOCTET*)buffer.constData();
+  source.pub.bytes_in_buffer = buffer.size();
+  decode();
+}
+
+/**
+ * Advances through the decoding stages until libjpeg runs out of data.  Each
+ * libjpeg call either completes or suspends, leaving us in a state to retry
+ * it when more data arrives.
+ */
+void JpegStreamDecoder::Private::decode()
+{
+  if (setjmp(error.jump)) {
+    state = Failed;
+    image = QImage();
+    return;
+  }
+
+  if (state == ReadingHeader) {
+    if (jpeg_read_header(&cinfo, TRUE) == JPEG_SUSPENDED) {
+      return;
+    }
+    cinfo.out_color_space = JCS_RGB;
+    state = Starting;
+  }
+
+  if (state == Starting) {
+    if (!jpeg_start_decompress(&cinfo)) {
+      return;
+    }
+    image = QImage(cinfo.output_width, cinfo.output_height,
+                   QImage::Format_RGB32);
+    row.resize(cinfo.output_width * cinfo.output_components);
+    state = image.isNull() ? Failed : ReadingScanlines;
+  }
+
+  while (state == ReadingScanlines &&
+         cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW rowPointer = row.data();
+    if (jpeg_read_scanlines(&cinfo, &rowPointer, 1) != 1) {
+      return;
+    }
+    convertRow(cinfo.output_scanline - 1);
+  }
+
+  if (state == ReadingScanlines) {
+    state = Finishing;
+  }
+
+  if (state == Finishing) {
+    if (!jpeg_finish_decompress(&cinfo)) {
+      return;
+    }
+    state = Done;
+  }
+}
+
+/**
+ * Copies the row libjpeg has just decoded into the image
+ */
+void JpegStreamDecoder::Private::convertRow(int y)
+{
+  QRgb* line = (QRgb*)image.scanLine(y);
+  const JSAMPLE* in = row.constData();
+  for (uint x = 0; x < cinfo.output_width; x++, in += 3) {
+    line[x] = qRgb(in[0], in[1], in[2]);
+  }
+}
+
+#else
+
+struct JpegStreamDecoder::Private
+{
+};
+
+#endif
+
+
+/**
+ * Constructor
+ */
+JpegStreamDecoder::JpegStreamDecoder(QObject* parent)
+  : QObject(parent),
+    d(new Private())
+{
+  qRegisterMetaType<QImage>("QImage");
+}
+
+/**
+ * Destructor
+ */
+JpegStreamDecoder::~JpegStreamDecoder()
+{
+  delete d;
+}
+
+/**
+ * Returns true if this build can decode JPEGs incrementally
+ */
+bool JpegStreamDecoder::isAvailable()
+{
+#ifdef HAVE_LIBJPEG
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Decodes as much as possible of the image, given the next chunk of the file
+ */
+void JpegStreamDecoder::addData(const QByteArray& data)
+{
+#ifdef HAVE_LIBJPEG
+  d->addData(data);
+#else
+  Q_UNUSED(data);
+#endif
+}
+
+/**
+ * Called once all the data has been given; emits decoded()
+ */
+void JpegStreamDecoder::finish()
+{
+#ifdef HAVE_LIBJPEG
+  if (d->state == Private::Done) {
+    emit decoded(d->image);
+    d->image = QImage();
+    return;
+  }
+#endif
+  emit decoded(QImage());
+}
@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef JPEGSTREAMDECODER_H
+#define JPEGSTREAMDECODER_H
+
+#include <QtGui>
+
+
+/**
+ * Decodes a JPEG incrementally as its bytes arrive, so that decoding a
+ * wallpaper can overlap with downloading it.  Meant to live on a worker
+ * thread: feed it with addData() as the download progresses, call finish()
+ * once the last byte has been given, and it emits decoded() with the image
+ * (or a null image if the data couldn't be decoded).
+ *
+ * Needs libjpeg; without it isAvailable() returns false and decoded() always
+ * reports a null image, leaving the caller to decode the file in the usual
+ * way.
+ */
+class JpegStreamDecoder : public QObject
+{
+  Q_OBJECT
+
+  public:
+    JpegStreamDecoder(QObject* parent = 0);
+    ~JpegStreamDecoder();
+    static bool isAvailable();
+
+  signals:
+    void decoded(const QImage& image);
+
+  public slots:
+    void addData(const QByteArray& data);
+    void finish();
+
+  private:
+    struct Private;
+    Private* d;
+};
+
+#endif
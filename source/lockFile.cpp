@@ -0,0 +1,274 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lockFile.h"
+#include <QHostInfo>
+
+#ifdef Q_WS_WIN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+namespace
+{
+  // A lock not refreshed for this long is assumed to have been abandoned,
+  // whoever holds it
+  const int MaxLockAgeSecs = 10 * 60;
+
+  // How long lock() waits between attempts
+  const int RetryMsecs = 20;
+
+  /*!
+   * Returns true if a process with the given ID is running on this machine
+   */
+  bool processExists(qint64 pid)
+  {
+#ifdef Q_WS_WIN
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+    if (!process) {
+      return false;
+    }
+    bool running = (WaitForSingleObject(process, 0) == WAIT_TIMEOUT);
+    CloseHandle(process);
+    return running;
+#else
+    return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+  }
+
+  /*!
+   * Returns what we write in a lock file to say that we hold it
+   */
+  QByteArray ownerRecord()
+  {
+    return QHostInfo::localHostName().toUtf8() + '\n' +
+           QByteArray::number(QCoreApplication::applicationPid()) + '\n';
+  }
+
+  void sleepMsecs(int msecs)
+  {
+#ifdef Q_WS_WIN
+    Sleep(msecs);
+#else
+    usleep(msecs * 1000);
+#endif
+  }
+}
+
+
+/*!
+ * Constructor; the lock is not taken until tryLock() or lock() is called
+ */
+LockFile::LockFile(const QString& fileName)
+  : mFileName(fileName),
+    mHeld(false)
+{
+}
+
+/*!
+ * Destructor; releases the lock if we hold it
+ */
+LockFile::~LockFile()
+{
+  unlock();
+}
+
+/*!
+ * Returns true if some process currently holds the lock \a fileName.  A
+ * stale lock doesn't count.
+ */
+bool LockFile::isLocked(const QString& fileName)
+{
+  return QFile::exists(fileName) && !isStale(fileName);
+}
+
+/*!
+ * Takes the lock if nobody else holds it, breaking it first if its holder
+ * has gone
+ * \returns true if we now hold the lock
+ */
+bool LockFile::tryLock()
+{
+  if (mHeld) {
+    return true;
+  }
+  if (!create() && isStale(mFileName) && breakStale()) {
+    create();
+  }
+  return mHeld;
+}
+
+/*!
+ * Brings the lock file up to date, to show that we still hold the lock.  If
+ * we turn out not to hold it any more, because it was broken, it is released.
+ * \returns true if we still hold the lock
+ */
+bool LockFile::refresh()
+{
+  if (!mHeld) {
+    return false;
+  }
+  QFile file(mFileName);
+  if (!file.open(QIODevice::ReadOnly) || file.readAll() != ownerRecord()) {
+    mHeld = false;
+    return false;
+  }
+  file.close();
+
+#ifdef Q_WS_WIN
+  HANDLE handle =
+    CreateFileW((const wchar_t*)QDir::toNativeSeparators(mFileName).utf16(),
+                FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return true;
+  }
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  SetFileTime(handle, NULL, NULL, &now);
+  CloseHandle(handle);
+#else
+  utime(QFile::encodeName(mFileName).constData(), NULL);
+#endif
+  return true;
+}
+
+/*!
+ * Waits up to \a timeoutMsecs for the lock.  Only for locks that are held
+ * briefly, since the event loop is not run meanwhile.
+ * \returns true if we now hold the lock
+ */
+bool LockFile::lock(int timeoutMsecs)
+{
+  QTime clock;
+  clock.start();
+  while (!tryLock()) {
+    if (clock.elapsed() >= timeoutMsecs) {
+      return false;
+    }
+    sleepMsecs(RetryMsecs);
+  }
+  return true;
+}
+
+/*!
+ * Releases the lock, if we hold it
+ */
+void LockFile::unlock()
+{
+  if (mHeld) {
+    QFile::remove(mFileName);
+    mHeld = false;
+  }
+}
+
+/*!
+ * Creates the lock file, failing if it already exists, and records who we
+ * are in it
+ */
+bool LockFile::create()
+{
+  QByteArray owner = ownerRecord();
+#ifdef Q_WS_WIN
+  HANDLE file =
+    CreateFileW((const wchar_t*)QDir::toNativeSeparators(mFileName).utf16(),
+                GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL,
+                NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  DWORD written;
+  WriteFile(file, owner.constData(), owner.size(), &written, NULL);
+  CloseHandle(file);
+#else
+  // Readable by all, so that other users can tell whether we're still alive
+  int file = open(QFile::encodeName(mFileName).constData(),
+                  O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (file < 0) {
+    return false;
+  }
+  ssize_t written = write(file, owner.constData(), owner.size());
+  Q_UNUSED(written);
+  close(file);
+#endif
+  mHeld = true;
+  return true;
+}
+
+/*!
+ * Gets a stale lock file out of the way.  Others may be trying to break it at
+ * the same time, so rather than deleting it, which could delete a fresh lock
+ * that one of them has just taken, we move it aside under a name of our own.
+ * If what we moved turns out not to be stale after all, it is put back.
+ * \returns true if the lock file is gone
+ */
+bool LockFile::breakStale()
+{
+  QString staleName = mFileName + '.' + QHostInfo::localHostName() + '.' +
+                      QString::number(QCoreApplication::applicationPid());
+  QFile::remove(staleName);
+  if (!QFile::rename(mFileName, staleName)) {
+    return false;
+  }
+  if (!isStale(staleName)) {
+    QFile::rename(staleName, mFileName);
+    return false;
+  }
+  QFile::remove(staleName);
+  return true;
+}
+
+/*!
+ * Returns true if the lock \a fileName was left behind: its holder, on this
+ * machine, is no longer running, or it is too old to be believed
+ */
+bool LockFile::isStale(const QString& fileName)
+{
+  QFileInfo info(fileName);
+  if (info.lastModified().secsTo(QDateTime::currentDateTime()) >
+      MaxLockAgeSecs) {
+    return true;
+  }
+
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+  QList<QByteArray> owner = file.readAll().split('\n');
+  if (owner.size() < 2 ||
+      QString::fromUtf8(owner[0]) != QHostInfo::localHostName()) {
+    // Held on another machine, or still being written
+    return false;
+  }
+  return !processExists(owner[1].toLongLong());
+}
@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LOCKFILE_H
+#define LOCKFILE_H
+
+#include <QtCore>
+
+
+/*!
+ * An advisory lock shared between processes, even those of different users:
+ * the lock is held by whoever manages to create the lock file, and released
+ * by deleting it.  The file records the host and process holding it, so that
+ * a lock left behind by a process that has died can be broken.  A lock held
+ * on another machine can only be judged by its age, so one held for more than
+ * a minute or so should be kept fresh with refresh().
+ */
+class LockFile
+{
+  public:
+    explicit LockFile(const QString& fileName);
+    ~LockFile();
+    static bool isLocked(const QString& fileName);
+    bool tryLock();
+    bool lock(int timeoutMsecs);
+    void unlock();
+    bool refresh();
+    bool isHeld() const { return mHeld; }
+
+  private:
+    const QString mFileName;
+    bool mHeld;
+
+    bool create();
+    bool breakStale();
+    static bool isStale(const QString& fileName);
+};
+
+#endif
@@ -37,6 +37,8 @@ int main(int argc, char* argv[])
 
   // This object will ensure we only have one running instance
   InstanceManager instanceManager("logos-wallpaper-updater");
+  QObject::connect(&instanceManager, SIGNAL(handingOver()),
+                   &app, SLOT(handOver()));
   if (appArgs.size() > 1 && appArgs[1] == "--quit") {
     bool success = instanceManager.
                      ensureSingleInstance(InstanceManager::ThisInstanceWins);
@@ -0,0 +1,128 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "memoryUsage.h"
+
+#if defined(Q_WS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_WS_MAC)
+#include <mach/mach.h>
+#include <malloc/malloc.h>
+#else
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#endif
+
+namespace
+{
+  /*!
+   * Formats \a bytes in kilobytes, or as unknown if negative
+   */
+  QString kilobytes(qint64 bytes)
+  {
+    if (bytes < 0) {
+      return "?";
+    }
+    return QString("%1 KB").arg(bytes / 1024);
+  }
+}
+
+/*!
+ * Returns the size of the process's resident set, in bytes
+ */
+qint64 MemoryUsage::residentBytes()
+{
+#if defined(Q_WS_WIN)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return -1;
+  }
+  return counters.WorkingSetSize;
+#elif defined(Q_WS_MAC)
+  task_basic_info_data_t info;
+  mach_msg_type_number_t count = TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), TASK_BASIC_INFO, (task_info_t)&info,
+                &count) != KERN_SUCCESS) {
+    return -1;
+  }
+  return info.resident_size;
+#else
+  // The second field of statm is the resident set, in pages
+  QFile statm("/proc/self/statm");
+  if (!statm.open(QIODevice::ReadOnly)) {
+    return -1;
+  }
+  QList<QByteArray> fields = statm.readAll().simplified().split(' ');
+  bool ok = false;
+  qint64 pages = (fields.size() > 1) ? fields[1].toLongLong(&ok) : 0;
+  if (!ok) {
+    return -1;
+  }
+  return pages * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+/*!
+ * Returns how many bytes of the heap are allocated
+ */
+qint64 MemoryUsage::heapBytes()
+{
+#if defined(Q_WS_MAC)
+  return mstats().bytes_used;
+#elif defined(__GLIBC__)
+  struct mallinfo info = mallinfo();
+  return (qint64)(uint)info.uordblks + (qint64)(uint)info.hblkhd;
+#else
+  return -1;
+#endif
+}
+
+/*!
+ * Returns freed heap memory to the system, so that it no longer counts
+ * against the resident set
+ */
+void MemoryUsage::trim()
+{
+#if defined(Q_WS_WIN)
+  HeapCompact(GetProcessHeap(), 0);
+#elif defined(__GLIBC__)
+  malloc_trim(0);
+#endif
+}
+
+/*!
+ * Returns a one-line summary of the process's memory use
+ */
+QString MemoryUsage::report()
+{
+  return QString("resident %1, heap %2").
+           arg(kilobytes(residentBytes())).arg(kilobytes(heapBytes()));
+}
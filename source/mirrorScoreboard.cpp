@@ -0,0 +1,288 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mirrorScoreboard.h"
+#include <algorithm>
+
+namespace
+{
+  // How many response times to keep for each mirror
+  const int MaxSamples = 20;
+
+  // Guesses for a mirror we know nothing about yet
+  const int DefaultFirstByteMsecs = 1000;
+  const double DefaultBytesPerSec = 100 * 1024;
+
+  // Size of a typical wallpaper, for weighing response time against speed
+  const double TypicalBytes = 500 * 1024;
+
+  // Added to a mirror's expected time for each failure in a row
+  const double FailurePenaltyMsecs = 10 * 1000;
+
+  // Limits on how long to wait for the first byte before trying another
+  // mirror as well
+  const int DefaultHedgeMsecs = 2000;
+  const int MinHedgeMsecs = 250;
+  const int MaxHedgeMsecs = 10 * 1000;
+  const int HedgePercentile = 95;
+
+  // Weight given to the newest throughput measurement
+  const double ThroughputWeight = 0.3;
+
+  // How often the figures are saved, at most, so that they survive the
+  // session ending without our being shut down cleanly
+  const int SaveIntervalMsecs = 5 * 60 * 1000;
+}
+
+
+/*!
+ * Constructor; \a mirrors are the base URLs, in order of preference when
+ * there is nothing else to go on, and \a settingsKey is where their figures
+ * are kept
+ */
+MirrorScoreboard::MirrorScoreboard(const QStringList& mirrors,
+                                   const QString& settingsKey)
+  : mMirrors(mirrors),
+    mSettingsKey(settingsKey),
+    mStats(),
+    mSinceSaved(),
+    mUnsaved(false)
+{
+  load();
+  mSinceSaved.start();
+}
+
+/*!
+ * Destructor
+ */
+MirrorScoreboard::~MirrorScoreboard()
+{
+  if (mUnsaved) {
+    save();
+  }
+}
+
+/*!
+ * Returns the mirrors, the one expected to deliver a typical wallpaper
+ * soonest first
+ */
+QStringList MirrorScoreboard::ranked() const
+{
+  QList<QPair<double, int> > scores;
+  for (int i = 0; i < mMirrors.size(); i++) {
+    scores << qMakePair(expectedMsecs(mMirrors[i]), i);
+  }
+  // Ties keep the configured order
+  std::stable_sort(scores.begin(), scores.end());
+
+  QStringList mirrors;
+  for (int i = 0; i < scores.size(); i++) {
+    mirrors << mMirrors[scores[i].second];
+  }
+  return mirrors;
+}
+
+/*!
+ * Returns how long to wait for the first byte from \a mirror before asking
+ * another mirror as well: long enough that it is rare for the mirror to be
+ * that slow.
+ */
+int MirrorScoreboard::hedgeDelay(const QString& mirror) const
+{
+  int percentile = firstBytePercentile(mirror, HedgePercentile);
+  if (percentile < 0) {
+    return DefaultHedgeMsecs;
+  }
+  return qBound(MinHedgeMsecs, percentile, MaxHedgeMsecs);
+}
+
+/*!
+ * Records that the first byte of \a url arrived \a msecs after it was
+ * requested
+ */
+void MirrorScoreboard::recordFirstByte(const QUrl& url, int msecs)
+{
+  QString mirror = mirrorFor(url);
+  if (mirror.isEmpty()) {
+    return;
+  }
+  Stats& stats = mStats[mirror];
+  stats.firstByteMsecs.prepend(qMax(0, msecs));
+  while (stats.firstByteMsecs.size() > MaxSamples) {
+    stats.firstByteMsecs.removeLast();
+  }
+  stats.failures = 0;
+  changed();
+}
+
+/*!
+ * Records that the body of \a url, \a bytes long, took \a msecs to arrive
+ * after the first byte
+ */
+void MirrorScoreboard::recordTransfer(const QUrl& url, qint64 bytes,
+                                      int msecs)
+{
+  QString mirror = mirrorFor(url);
+  if (mirror.isEmpty() || bytes <= 0) {
+    return;
+  }
+  Stats& stats = mStats[mirror];
+  double bytesPerSec = bytes * 1000.0 / qMax(1, msecs);
+  if (stats.bytesPerSec <= 0) {
+    stats.bytesPerSec = bytesPerSec;
+  } else {
+    stats.bytesPerSec = ThroughputWeight * bytesPerSec +
+                        (1 - ThroughputWeight) * stats.bytesPerSec;
+  }
+  changed();
+}
+
+/*!
+ * Records that a request for \a url failed before anything useful arrived
+ */
+void MirrorScoreboard::recordFailure(const QUrl& url)
+{
+  QString mirror = mirrorFor(url);
+  if (mirror.isEmpty()) {
+    return;
+  }
+  mStats[mirror].failures++;
+  changed();
+}
+
+/*!
+ * Returns the mirror that \a url belongs to, or an empty string if none.
+ * A mirror's base is taken to end in '/', so that it doesn't also match
+ * another host or directory whose name it begins.
+ */
+QString MirrorScoreboard::mirrorFor(const QUrl& url) const
+{
+  QString string = url.toString();
+  foreach (QString mirror, mMirrors) {
+    QString base = mirror.endsWith('/') ? mirror : mirror + '/';
+    if (string.startsWith(base)) {
+      return mirror;
+    }
+  }
+  return QString();
+}
+
+/*!
+ * Returns how long \a mirror can be expected to take to deliver a typical
+ * wallpaper, going by its median response time and its throughput
+ */
+double MirrorScoreboard::expectedMsecs(const QString& mirror) const
+{
+  Stats stats = mStats.value(mirror);
+  int firstByte = firstBytePercentile(mirror, 50);
+  if (firstByte < 0) {
+    firstByte = DefaultFirstByteMsecs;
+  }
+  double bytesPerSec = (stats.bytesPerSec > 0) ? stats.bytesPerSec :
+                                                 DefaultBytesPerSec;
+  return firstByte + TypicalBytes * 1000 / bytesPerSec +
+         stats.failures * FailurePenaltyMsecs;
+}
+
+/*!
+ * Returns the given percentile of \a mirror's recent response times, or -1
+ * if we have none
+ */
+int MirrorScoreboard::firstBytePercentile(const QString& mirror,
+                                          int percent) const
+{
+  QList<int> samples = mStats.value(mirror).firstByteMsecs;
+  if (samples.isEmpty()) {
+    return -1;
+  }
+  qSort(samples);
+  int index = (samples.size() - 1) * percent / 100;
+  return samples[index];
+}
+
+/*!
+ * Notes that the figures have changed, saving them if it has been a while
+ */
+void MirrorScoreboard::changed()
+{
+  mUnsaved = true;
+  if (mSinceSaved.elapsed() >= SaveIntervalMsecs) {
+    mSinceSaved.restart();
+    mUnsaved = false;
+    save();
+  }
+}
+
+/*!
+ * Reads the figures kept from earlier runs, for mirrors still configured
+ */
+void MirrorScoreboard::load()
+{
+  QSettings settings;
+  int count = settings.beginReadArray(mSettingsKey);
+  for (int i = 0; i < count; i++) {
+    settings.setArrayIndex(i);
+    QString mirror = settings.value("url").toString();
+    if (!mMirrors.contains(mirror)) {
+      continue;
+    }
+    Stats stats;
+    foreach (QString sample,
+             settings.value("firstByteMsecs").toStringList()) {
+      stats.firstByteMsecs << sample.toInt();
+    }
+    stats.bytesPerSec = settings.value("bytesPerSec").toDouble();
+    stats.failures = settings.value("failures").toInt();
+    mStats.insert(mirror, stats);
+  }
+  settings.endArray();
+}
+
+/*!
+ * Stores the figures for next time
+ */
+void MirrorScoreboard::save() const
+{
+  QSettings settings;
+  settings.beginWriteArray(mSettingsKey, mStats.size());
+  int i = 0;
+  QHashIterator<QString, Stats> iter(mStats);
+  while (iter.hasNext()) {
+    iter.next();
+    settings.setArrayIndex(i++);
+    QStringList samples;
+    foreach (int sample, iter.value().firstByteMsecs) {
+      samples << QString::number(sample);
+    }
+    settings.setValue("url", iter.key());
+    settings.setValue("firstByteMsecs", samples);
+    settings.setValue("bytesPerSec", iter.value().bytesPerSec);
+    settings.setValue("failures", iter.value().failures);
+  }
+  settings.endArray();
+}
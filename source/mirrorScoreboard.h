@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MIRRORSCOREBOARD_H
+#define MIRRORSCOREBOARD_H
+
+#include <QtCore>
+
+
+/*!
+ * Keeps track of how quickly each wallpaper mirror responds (time to first
+ * byte) and how fast it transfers, and ranks the mirrors accordingly.  The
+ * figures are kept in the settings, so that they survive restarts.
+ *
+ * Mirrors are identified by their base URL; results are recorded against
+ * the full URL of a file, which must start with one of them.  Each set of
+ * mirrors keeps its figures under its own settings key.  They are saved
+ * every few minutes at most, and on destruction, rather than on every
+ * result.
+ */
+class MirrorScoreboard
+{
+  public:
+    explicit MirrorScoreboard(const QStringList& mirrors,
+                              const QString& settingsKey = "mirrorStats");
+    ~MirrorScoreboard();
+    QStringList ranked() const;
+    int hedgeDelay(const QString& mirror) const;
+    void recordFirstByte(const QUrl& url, int msecs);
+    void recordTransfer(const QUrl& url, qint64 bytes, int msecs);
+    void recordFailure(const QUrl& url);
+
+  private:
+    struct Stats
+    {
+      Stats() : bytesPerSec(0), failures(0) {}
+
+      // Most recent first
+      QList<int> firstByteMsecs;
+      double bytesPerSec;
+      int failures;
+    };
+
+    QStringList mMirrors;
+    QString mSettingsKey;
+    QHash<QString, Stats> mStats;
+    QTime mSinceSaved;
+    bool mUnsaved;
+
+    QString mirrorFor(const QUrl& url) const;
+    double expectedMsecs(const QString& mirror) const;
+    int firstBytePercentile(const QString& mirror, int percent) const;
+    void changed();
+    void load();
+    void save() const;
+};
+
+#endif
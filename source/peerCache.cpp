@@ -0,0 +1,360 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "peerCache.moc"
+#include "wallpaperCache.h"
+
+namespace
+{
+  // Marks our datagrams apart from anything else on the port
+  const char* const WantMessage = "LWU-WANT";
+  const char* const HaveMessage = "LWU-HAVE";
+
+  const quint16 DefaultPort = 45454;
+  const int DefaultWaitMsecs = 500;
+
+  // Requests larger than this aren't from one of us
+  const int MaxRequestBytes = 8 * 1024;
+
+  // Files are sent this much at a time, as the socket drains
+  const qint64 SendChunkBytes = 64 * 1024;
+}
+
+
+/**
+ * Constructor
+ * @param cache The cache to offer to peers
+ */
+PeerCache::PeerCache(const WallpaperCache* cache, QObject* parent)
+  : QObject(parent),
+    mCache(cache),
+    mSocket(new QUdpSocket(this)),
+    mServer(new QTcpServer(this)),
+    mReadyReadMapper(new QSignalMapper(this)),
+    mBytesWrittenMapper(new QSignalMapper(this)),
+    mTimeoutMapper(new QSignalMapper(this)),
+    mPort(DefaultPort),
+    mWaitMsecs(DefaultWaitMsecs),
+    mInstanceId(QByteArray::number(qrand(), 16) +
+                QByteArray::number(QCoreApplication::applicationPid(), 16)),
+    mLookupHashes(),
+    mLookupTimers()
+{
+  QSettings settings;
+  mPort = settings.value("peers/port", DefaultPort).toUInt();
+  mWaitMsecs = settings.value("peers/waitMsecs", DefaultWaitMsecs).toInt();
+
+  connect(mSocket, SIGNAL(readyRead()), this, SLOT(datagramsReady()));
+  connect(mServer, SIGNAL(newConnection()), this, SLOT(serverConnection()));
+  connect(mReadyReadMapper, SIGNAL(mapped(QObject*)),
+          this, SLOT(serverReadyRead(QObject*)));
+  connect(mBytesWrittenMapper, SIGNAL(mapped(QObject*)),
+          this, SLOT(serverBytesWritten(QObject*)));
+  connect(mTimeoutMapper, SIGNAL(mapped(const QString&)),
+          this, SLOT(lookupTimedOut(const QString&)));
+}
+
+/**
+ * Destructor
+ */
+PeerCache::~PeerCache()
+{
+}
+
+/**
+ * Returns true if the user has chosen to share wallpapers with peers
+ */
+bool PeerCache::isEnabled()
+{
+  QSettings settings;
+  return settings.value("peers/enabled", false).toBool();
+}
+
+/**
+ * Starts listening for peers' lookups and requests
+ * @returns false if either socket couldn't be opened
+ */
+bool PeerCache::start()
+{
+  if (!mSocket->bind(mPort, QUdpSocket::ShareAddress |
+                              QUdpSocket::ReuseAddressHint)) {
+    qWarning() << "Unable to listen for peers:" << mSocket->errorString();
+    return false;
+  }
+  if (!mServer->listen()) {
+    qWarning() << "Unable to serve peers:" << mServer->errorString();
+    mSocket->close();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Asks the peers for the file \a name with the given SHA-256 hash (in hex).
+ * lookupFinished() is emitted with the URL to fetch it from, or an invalid
+ * URL if no peer has it.
+ */
+void PeerCache::lookup(const QString& name, const QByteArray& hash)
+{
+  if (mLookupTimers.contains(name)) {
+    return;
+  }
+
+  QTimer* timer = new QTimer(this);
+  timer->setSingleShot(true);
+  connect(timer, SIGNAL(timeout()), mTimeoutMapper, SLOT(map()));
+  mTimeoutMapper->setMapping(timer, name);
+  mLookupTimers.insert(name, timer);
+  mLookupHashes.insert(name, hash.toLower());
+  timer->start(mWaitMsecs);
+
+  QByteArray message = QByteArray(WantMessage) + ' ' + mInstanceId + ' ' +
+                       name.toUtf8() + ' ' + hash.toLower();
+  mSocket->writeDatagram(message, QHostAddress::Broadcast, mPort);
+  // Broadcasts don't always come back to this machine
+  mSocket->writeDatagram(message, QHostAddress::LocalHost, mPort);
+}
+
+/**
+ * Handles lookups from peers, and answers to our own
+ */
+void PeerCache::datagramsReady()
+{
+  while (mSocket->hasPendingDatagrams()) {
+    QByteArray datagram(mSocket->pendingDatagramSize(), 0);
+    QHostAddress sender;
+    quint16 senderPort;
+    mSocket->readDatagram(datagram.data(), datagram.size(),
+                          &sender, &senderPort);
+
+    // WANT <requester> <name> <hash>
+    // HAVE <requester> <name> <hash> <port>
+    QList<QByteArray> fields = datagram.split(' ');
+    if (fields.size() == 4 && fields[0] == WantMessage &&
+        fields[1] != mInstanceId) {
+      answer(fields, sender, senderPort);
+    } else if (fields.size() == 5 && fields[0] == HaveMessage &&
+               fields[1] == mInstanceId) {
+      QString name = QString::fromUtf8(fields[2]);
+      quint16 port = fields[4].toUShort();
+      if (mLookupHashes.value(name) == fields[3] && port != 0) {
+        QUrl url;
+        url.setScheme("http");
+        url.setHost(sender.toString());
+        url.setPort(port);
+        url.setPath("/" + name);
+        finishLookup(name, url);
+      }
+    }
+  }
+}
+
+/**
+ * Tells a peer where to fetch the file it is looking for, if we have it
+ */
+void PeerCache::answer(const QList<QByteArray>& fields,
+                       const QHostAddress& sender, quint16 senderPort)
+{
+  QString name = QString::fromUtf8(fields[2]);
+  if (!canServe(name, fields[3])) {
+    return;
+  }
+  QByteArray message = QByteArray(HaveMessage) + ' ' + fields[1] + ' ' +
+                       fields[2] + ' ' + fields[3] + ' ' +
+                       QByteArray::number(mServer->serverPort());
+  mSocket->writeDatagram(message, sender, senderPort);
+}
+
+/**
+ * Called when nobody has offered a file in time
+ */
+void PeerCache::lookupTimedOut(const QString& name)
+{
+  finishLookup(name, QUrl());
+}
+
+/**
+ * Reports the outcome of a lookup, if it is still outstanding
+ */
+void PeerCache::finishLookup(const QString& name, const QUrl& url)
+{
+  QTimer* timer = mLookupTimers.take(name);
+  if (!timer) {
+    return;
+  }
+  mLookupHashes.remove(name);
+  timer->deleteLater();
+  emit lookupFinished(name, url);
+}
+
+/**
+ * Returns true if \a name is a downloaded wallpaper in our cache with the
+ * given hash.  Files we have derived from the wallpapers aren't offered.
+ */
+bool PeerCache::canServe(const QString& name, const QByteArray& hash) const
+{
+  CacheIndex::Entry entry = mCache->entry(name);
+  return entry.isValid() && hash.size() == 64 && entry.hash == hash &&
+         name == WallpaperCache::fileName(entry.month, entry.year,
+                                          entry.resolution) &&
+         QFile::exists(mCache->filePath(name));
+}
+
+/**
+ * Called when a peer has connected to fetch a file
+ */
+void PeerCache::serverConnection()
+{
+  QTcpSocket* socket = mServer->nextPendingConnection();
+  connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+
+  connect(socket, SIGNAL(readyRead()), mReadyReadMapper, SLOT(map()));
+  mReadyReadMapper->setMapping(socket, socket);
+}
+
+/**
+ * Collects a peer's request until it is complete, then answers it
+ */
+void PeerCache::serverReadyRead(QObject* socketObject)
+{
+  QTcpSocket* socket = qobject_cast<QTcpSocket*>(socketObject);
+  QByteArray request = socket->property("request").toByteArray() +
+                       socket->readAll();
+  if (request.size() > MaxRequestBytes) {
+    socket->abort();
+    return;
+  }
+  if (!request.contains("\r\n\r\n")) {
+    socket->setProperty("request", request);
+    return;
+  }
+  socket->disconnect(mReadyReadMapper);
+  serve(socket, request);
+}
+
+/**
+ * Sends the file asked for in \a request, or a 404 if we can't.  If the
+ * request carries the validators we would send, the peer already has the
+ * file and gets a 304.  The file itself is sent a chunk at a time as the
+ * socket drains, then the connection is closed.
+ */
+void PeerCache::serve(QTcpSocket* socket, const QByteArray& request)
+{
+  // GET /<name> HTTP/1.x
+  QList<QByteArray> lines = request.left(request.indexOf("\r\n\r\n")).
+                              split('\n');
+  QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+  QString name;
+  if (requestLine.size() == 3 && requestLine[0] == "GET" &&
+      requestLine[1].startsWith('/')) {
+    name = QString::fromUtf8(
+             QByteArray::fromPercentEncoding(requestLine[1].mid(1)));
+  }
+
+  QByteArray ifNoneMatch;
+  QByteArray ifModifiedSince;
+  foreach (const QByteArray& line, lines) {
+    int colon = line.indexOf(':');
+    QByteArray field = line.left(colon).trimmed().toLower();
+    if (field == "if-none-match") {
+      ifNoneMatch = line.mid(colon + 1).trimmed();
+    } else if (field == "if-modified-since") {
+      ifModifiedSince = line.mid(colon + 1).trimmed();
+    }
+  }
+
+  QFile* file = NULL;
+  CacheIndex::Entry entry = mCache->entry(name);
+  if (!name.isEmpty() && canServe(name, entry.hash)) {
+    file = new QFile(mCache->filePath(name), socket);
+    if (!file->open(QIODevice::ReadOnly) || file->size() == 0) {
+      delete file;
+      file = NULL;
+    }
+  }
+
+  // The validators are the origin server's, so they mean the same here
+  bool notModified = false;
+  if (file && !ifNoneMatch.isEmpty()) {
+    notModified = !entry.eTag.isEmpty() && ifNoneMatch == entry.eTag;
+  } else if (file && !ifModifiedSince.isEmpty()) {
+    notModified = !entry.lastModified.isEmpty() &&
+                  ifModifiedSince == entry.lastModified;
+  }
+
+  QByteArray header;
+  if (!file) {
+    header = "HTTP/1.0 404 Not Found\r\n"
+             "Content-Length: 0\r\n";
+  } else if (notModified) {
+    header = "HTTP/1.0 304 Not Modified\r\n";
+  } else {
+    header = "HTTP/1.0 200 OK\r\n"
+             "Content-Type: image/jpeg\r\n"
+             "Content-Length: " + QByteArray::number(file->size()) + "\r\n";
+  }
+  if (file && !entry.eTag.isEmpty()) {
+    header += "ETag: " + entry.eTag + "\r\n";
+  }
+  if (file && !entry.lastModified.isEmpty()) {
+    header += "Last-Modified: " + entry.lastModified + "\r\n";
+  }
+  header += "Connection: close\r\n\r\n";
+  socket->write(header);
+
+  if (!file || notModified) {
+    socket->disconnectFromHost();
+    return;
+  }
+  connect(socket, SIGNAL(bytesWritten(qint64)),
+          mBytesWrittenMapper, SLOT(map()));
+  mBytesWrittenMapper->setMapping(socket, socket);
+  serverBytesWritten(socket);
+}
+
+/**
+ * Tops up the socket's send buffer with the next chunk of the file it is
+ * sending, closing the connection once the whole file has been queued
+ */
+void PeerCache::serverBytesWritten(QObject* socketObject)
+{
+  QTcpSocket* socket = qobject_cast<QTcpSocket*>(socketObject);
+  QFile* file = socket->findChild<QFile*>();
+  if (!file || socket->bytesToWrite() >= SendChunkBytes) {
+    return;
+  }
+  QByteArray chunk = file->read(SendChunkBytes);
+  if (!chunk.isEmpty()) {
+    socket->write(chunk);
+  }
+  if (chunk.size() < SendChunkBytes || file->atEnd()) {
+    socket->disconnect(mBytesWrittenMapper);
+    delete file;
+    socket->disconnectFromHost();
+  }
+}
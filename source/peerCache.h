@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PEERCACHE_H
+#define PEERCACHE_H
+
+#include <QtNetwork>
+
+class WallpaperCache;
+
+
+/**
+ * Shares the wallpaper cache with other instances on the local network, so
+ * that a site behind a slow link only needs to fetch each wallpaper from the
+ * internet once.
+ *
+ * Before downloading a wallpaper, an instance broadcasts the file's name and
+ * SHA-256 hash (from the checksum manifest) over UDP.  Any instance that has
+ * that exact file replies with the port of a small HTTP server from which it
+ * can be fetched.  If nobody replies within a short time, the lookup reports
+ * no peer and the file is fetched from the internet as usual.  The hash is
+ * checked by the downloader in either case.  A peer passes on the validators
+ * it had from the origin server, so the file can later be revalidated against
+ * the mirrors as if it had come from them.
+ *
+ * Sharing is off unless "peers/enabled" is set.  Several instances on one
+ * machine can share the discovery port, which makes it possible to try this
+ * out locally.
+ */
+class PeerCache : public QObject
+{
+  Q_OBJECT
+
+  public:
+    PeerCache(const WallpaperCache* cache, QObject* parent = 0);
+    ~PeerCache();
+    static bool isEnabled();
+    bool start();
+    void lookup(const QString& name, const QByteArray& hash);
+
+  signals:
+    void lookupFinished(const QString& name, const QUrl& url);
+
+  private slots:
+    void datagramsReady();
+    void lookupTimedOut(const QString& name);
+    void serverConnection();
+    void serverReadyRead(QObject* socketObject);
+    void serverBytesWritten(QObject* socketObject);
+
+  private:
+    const WallpaperCache* mCache;
+    QUdpSocket* mSocket;
+    QTcpServer* mServer;
+    QSignalMapper* mReadyReadMapper;
+    QSignalMapper* mBytesWrittenMapper;
+    QSignalMapper* mTimeoutMapper;
+    quint16 mPort;
+    int mWaitMsecs;
+    QByteArray mInstanceId;
+    QHash<QString, QByteArray> mLookupHashes;
+    QHash<QString, QTimer*> mLookupTimers;
+
+    bool canServe(const QString& name, const QByteArray& hash) const;
+    void answer(const QList<QByteArray>& fields, const QHostAddress& sender,
+                quint16 senderPort);
+    void finishLookup(const QString& name, const QUrl& url);
+    void serve(QTcpSocket* socket, const QByteArray& request);
+};
+
+#endif
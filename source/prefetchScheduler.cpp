@@ -0,0 +1,154 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "prefetchScheduler.moc"
+#include "wallpaperGetter.h"
+#include "deadlineScheduler.h"
+
+namespace
+{
+  // How many days before the end of the month to start prefetching
+  const int WindowDays = 3;
+  // The first attempt is spread over this many seconds
+  const int InitialJitterSecs = 24 * 60 * 60;
+  // Retry delays start here and double after each failure...
+  const int NotYetAvailableRetrySecs = 60 * 60;
+  const int ErrorRetrySecs = 10 * 60;
+  // ...up to this limit
+  const int MaxRetrySecs = 12 * 60 * 60;
+
+  /**
+   * Returns a random number of seconds in the range [0, limit)
+   */
+  int randomSecs(int limit)
+  {
+    return (int)(limit * (qrand() / (RAND_MAX + 1.0)));
+  }
+}
+
+
+/**
+ * Constructor
+ */
+PrefetchScheduler::PrefetchScheduler(WallpaperGetter* getter,
+                                     DeadlineScheduler* scheduler,
+                                     QObject* parent)
+  : QObject(parent),
+    mGetter(getter),
+    mScheduler(scheduler),
+    mTargetMonth(),
+    mNextAttempt(),
+    mFailures(0),
+    mInProgress(false)
+{
+  connect(mGetter, SIGNAL(prefetchFinished(bool, bool)),
+          this, SLOT(prefetchFinished(bool, bool)));
+}
+
+/**
+ * Destructor
+ */
+PrefetchScheduler::~PrefetchScheduler()
+{
+}
+
+/**
+ * Works out when next month's wallpaper should next be fetched, and sets the
+ * deadline accordingly.  Safe to call at any time.
+ */
+void PrefetchScheduler::reschedule()
+{
+  QDate today = QDate::currentDate();
+  QDate nextMonth = QDate(today.year(), today.month(), 1).addMonths(1);
+  QDateTime now = QDateTime::currentDateTime();
+  QDateTime monthStart(nextMonth);
+
+  // A new month means a new target
+  if (nextMonth != mTargetMonth) {
+    mTargetMonth = nextMonth;
+    mNextAttempt = QDateTime();
+    mFailures = 0;
+  }
+
+  mScheduler->cancel(this, "attempt");
+  if (mInProgress || mGetter->isCached(nextMonth.month(), nextMonth.year())) {
+    return;
+  }
+
+  if (!mNextAttempt.isValid()) {
+    QDateTime windowStart(nextMonth.addDays(-WindowDays));
+    QDateTime earliest = qMax(now, windowStart);
+    int jitterSecs = qMin(InitialJitterSecs, earliest.secsTo(monthStart) / 2);
+    mNextAttempt = earliest.addSecs(randomSecs(qMax(jitterSecs, 1)));
+  }
+
+  // Too late; the wallpaper will be fetched in the usual way
+  if (mNextAttempt >= monthStart) {
+    return;
+  }
+
+  mScheduler->schedule(this, "attempt", mNextAttempt);
+}
+
+/**
+ * Called when the next attempt is due; starts the prefetch
+ */
+void PrefetchScheduler::attempt()
+{
+  mInProgress = true;
+  mGetter->prefetchWallpaper(mTargetMonth.month(), mTargetMonth.year());
+}
+
+/**
+ * Called when a prefetch has completed; schedules a retry if it failed.  If
+ * the retry queue held it back, or has begun backing off after the failure,
+ * the retry is simply due when the retry queue allows it.
+ */
+void PrefetchScheduler::prefetchFinished(bool succeeded, bool notYetAvailable)
+{
+  if (!mInProgress) {
+    return;
+  }
+  mInProgress = false;
+
+  QDateTime heldUntil =
+    mGetter->nextPrefetchAttempt(mTargetMonth.month(), mTargetMonth.year());
+  if (!succeeded && heldUntil.isValid()) {
+    mNextAttempt = heldUntil;
+  } else if (!succeeded) {
+    int baseSecs = notYetAvailable ? NotYetAvailableRetrySecs : ErrorRetrySecs;
+    int delaySecs = baseSecs << qMin(mFailures, 10);
+    delaySecs = qMin(delaySecs, MaxRetrySecs);
+    // +/- 20%, so that retries don't line up across machines
+    delaySecs += randomSecs(delaySecs * 2 / 5 + 1) - delaySecs / 5;
+    mFailures++;
+    mNextAttempt = QDateTime::currentDateTime().addSecs(delaySecs);
+  }
+
+  reschedule();
+}
@@ -0,0 +1,71 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PREFETCHSCHEDULER_H
+#define PREFETCHSCHEDULER_H
+
+#include <QtCore>
+
+class WallpaperGetter;
+class DeadlineScheduler;
+
+/**
+ * Fetches next month's wallpaper into the cache during the last few days of
+ * the current month, so that it can be set without touching the network when
+ * the month changes.  Attempts are spread out with random jitter so that
+ * machines don't all hit the server together, and failures (including the
+ * image not having been published yet) are retried with exponential backoff.
+ * Where the getter's retry queue is already holding the wallpaper back, its
+ * backoff is followed instead, rather than stacking another on top of it.
+ */
+class PrefetchScheduler : public QObject
+{
+  Q_OBJECT
+
+  public:
+    PrefetchScheduler(WallpaperGetter* getter, DeadlineScheduler* scheduler,
+                      QObject* parent = 0);
+    ~PrefetchScheduler();
+
+  public slots:
+    void reschedule();
+
+  private slots:
+    void attempt();
+    void prefetchFinished(bool succeeded, bool notYetAvailable);
+
+  private:
+    WallpaperGetter* mGetter;
+    DeadlineScheduler* mScheduler;
+    QDate mTargetMonth;
+    QDateTime mNextAttempt;
+    int mFailures;
+    bool mInProgress;
+};
+
+#endif
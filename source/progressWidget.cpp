@@ -37,6 +37,7 @@ ProgressWidget::ProgressWidget(QWidget* parent)
     ui()
 {
   ui.setupUi(this);
+  connect(ui.buttonBox, SIGNAL(rejected()), this, SIGNAL(cancelled()));
 }
 
 /**
@@ -46,6 +47,15 @@ ProgressWidget::~ProgressWidget()
 {
 }
 
+/**
+ * Closing the window cancels whatever it is showing the progress of
+ */
+void ProgressWidget::closeEvent(QCloseEvent* event)
+{
+  emit cancelled();
+  QWidget::closeEvent(event);
+}
+
 /**
  * Updates the progress bar
  */
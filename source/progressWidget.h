@@ -46,8 +46,13 @@ class ProgressWidget : public QWidget
     void reportSuccess(QString messageString);
     void reportError(QString errorString);
 
+  signals:
+    void cancelled();
+
   private:
     Ui::ProgressWidget ui;
+
+    void closeEvent(QCloseEvent* event);
 };
 
 #endif
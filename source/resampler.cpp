@@ -0,0 +1,457 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "resampler.h"
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#else
+#define HAVE_SSE2 0
+#endif
+
+namespace
+{
+  // Filter weights are fixed-point with this many fractional bits
+  const int WeightBits = 14;
+  const int WeightOne = 1 << WeightBits;
+  // Enlarging by this factor or more uses the Catmull-Rom filter: there is no
+  // fine detail for Lanczos to keep, and four taps do instead of six
+  const double CubicUpscale = 2.0;
+  // Each pass is split into bands of this many output rows
+  const int BandRows = 64;
+
+  /**
+   * The Lanczos-3 kernel
+   */
+  double lanczos(double x)
+  {
+    if (x == 0.0) {
+      return 1.0;
+    }
+    if (x <= -3.0 || x >= 3.0) {
+      return 0.0;
+    }
+    double px = M_PI * x;
+    return 3.0 * sin(px) * sin(px / 3.0) / (px * px);
+  }
+
+  /**
+   * The Catmull-Rom kernel
+   */
+  double catmullRom(double x)
+  {
+    x = fabs(x);
+    if (x < 1.0) {
+      return (1.5 * x - 2.5) * x * x + 1.0;
+    }
+    if (x < 2.0) {
+      return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+    }
+    return 0.0;
+  }
+
+  /**
+   * For each output pixel along one axis, the run of input pixels that
+   * contribute to it and their weights
+   */
+  struct Contributions
+  {
+    QVector<int> first;
+    QVector<int> count;
+    QVector<qint16> weights;
+    int stride;
+  };
+
+  /**
+   * Works out the filter taps that map \a inSize pixels starting at
+   * \a inOffset onto \a outSize pixels.  The weights for each output pixel
+   * sum to exactly WeightOne, so flat areas stay flat.
+   */
+  Contributions contributions(int inOffset, int inSize, int outSize)
+  {
+    double scale = (double)inSize / outSize;
+    double filterScale = qMax(scale, 1.0);
+    bool cubic = (scale <= 1.0 / CubicUpscale);
+    double support = (cubic ? 2.0 : 3.0) * filterScale;
+
+    Contributions c;
+    c.stride = (int)ceil(support) * 2 + 1;
+    c.first.resize(outSize);
+    c.count.resize(outSize);
+    c.weights.fill(0, outSize * c.stride);
+
+    QVector<double> weights(c.stride);
+    for (int i = 0; i < outSize; i++) {
+      double center = inOffset + (i + 0.5) * scale;
+      int first = qMax((int)(center - support + 0.5), inOffset);
+      int last = qMin((int)(center + support + 0.5), inOffset + inSize);
+      int count = qMin(last - first, c.stride);
+
+      double total = 0.0;
+      for (int k = 0; k < count; k++) {
+        double x = (first + k + 0.5 - center) / filterScale;
+        weights[k] = cubic ? catmullRom(x) : lanczos(x);
+        total += weights[k];
+      }
+
+      qint16* fixed = c.weights.data() + i * c.stride;
+      int fixedTotal = 0;
+      int largest = 0;
+      for (int k = 0; k < count; k++) {
+        fixed[k] = (qint16)floor(weights[k] / total * WeightOne + 0.5);
+        fixedTotal += fixed[k];
+        if (fixed[k] > fixed[largest]) {
+          largest = k;
+        }
+      }
+      // Put any rounding error into the largest weight
+      fixed[largest] += WeightOne - fixedTotal;
+
+      c.first[i] = first;
+      c.count[i] = count;
+    }
+    return c;
+  }
+
+  /**
+   * Rounds a fixed-point channel sum back to 8 bits
+   */
+  inline quint8 clampChannel(qint32 sum)
+  {
+    sum = (sum + (WeightOne >> 1)) >> WeightBits;
+    return (quint8)qBound(0, sum, 255);
+  }
+
+  /**
+   * Filters one row horizontally; pixels are 4 bytes, one per channel
+   */
+  void horizontalScalar(const quint8* in, quint8* out,
+                        const Contributions& c, int from, int to)
+  {
+    for (int x = from; x < to; x++) {
+      const quint8* pixel = in + c.first[x] * 4;
+      const qint16* weights = c.weights.constData() + x * c.stride;
+      qint32 sum[4] = {0, 0, 0, 0};
+      for (int k = 0; k < c.count[x]; k++) {
+        for (int channel = 0; channel < 4; channel++) {
+          sum[channel] += pixel[k * 4 + channel] * weights[k];
+        }
+      }
+      for (int channel = 0; channel < 4; channel++) {
+        out[x * 4 + channel] = clampChannel(sum[channel]);
+      }
+    }
+  }
+
+  /**
+   * Filters one output row vertically from the rows of \a in
+   */
+  void verticalScalar(const quint8* const* in, quint8* out,
+                      const qint16* weights, int count, int from, int to)
+  {
+    for (int i = from * 4; i < to * 4; i++) {
+      qint32 sum = 0;
+      for (int k = 0; k < count; k++) {
+        sum += in[k][i] * weights[k];
+      }
+      out[i] = clampChannel(sum);
+    }
+  }
+
+#if HAVE_SSE2
+  /**
+   * Rounds four 32-bit channel sums and packs them into one pixel.  The
+   * saturating packs clamp to [0, 255] exactly as clampChannel() does.
+   */
+  inline quint32 packPixel(__m128i sum)
+  {
+    sum = _mm_add_epi32(sum, _mm_set1_epi32(WeightOne >> 1));
+    sum = _mm_srai_epi32(sum, WeightBits);
+    sum = _mm_packs_epi32(sum, sum);
+    sum = _mm_packus_epi16(sum, sum);
+    return (quint32)_mm_cvtsi128_si32(sum);
+  }
+
+  /**
+   * SSE2 version of horizontalScalar().  Taps are taken two at a time: the
+   * channels of two neighbouring pixels are interleaved so that a single
+   * multiply-add applies both weights.
+   */
+  void horizontalSse2(const quint8* in, quint8* out,
+                      const Contributions& c, int from, int to)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    for (int x = from; x < to; x++) {
+      const quint8* pixel = in + c.first[x] * 4;
+      const qint16* weights = c.weights.constData() + x * c.stride;
+      int count = c.count[x];
+      __m128i sum = zero;
+      int k = 0;
+      for (; k + 1 < count; k += 2) {
+        __m128i pair = _mm_loadl_epi64((const __m128i*)(pixel + k * 4));
+        pair = _mm_unpacklo_epi8(pair, _mm_srli_si128(pair, 4));
+        pair = _mm_unpacklo_epi8(pair, zero);
+        __m128i w = _mm_set1_epi32(((quint32)(quint16)weights[k + 1] << 16) |
+                                   (quint16)weights[k]);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(pair, w));
+      }
+      if (k < count) {
+        __m128i single = _mm_cvtsi32_si128(*(const int*)(pixel + k * 4));
+        single = _mm_unpacklo_epi8(_mm_unpacklo_epi8(single, zero), zero);
+        __m128i w = _mm_set1_epi32((quint16)weights[k]);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(single, w));
+      }
+      *(quint32*)(out + x * 4) = packPixel(sum);
+    }
+  }
+
+  /**
+   * SSE2 version of verticalScalar(), four pixels at a time.  Taps are taken
+   * two rows at a time, interleaving the rows' bytes for the multiply-add.
+   * Any pixels left over at the end of the row are done by the scalar code.
+   */
+  void verticalSse2(const quint8* const* in, quint8* out,
+                    const qint16* weights, int count, int from, int to)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    int x = from;
+    for (; x + 4 <= to; x += 4) {
+      __m128i sum[4] = {zero, zero, zero, zero};
+      for (int k = 0; k < count; k += 2) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(in[k] + x * 4));
+        __m128i b = zero;
+        quint32 wb = 0;
+        if (k + 1 < count) {
+          b = _mm_loadu_si128((const __m128i*)(in[k + 1] + x * 4));
+          wb = (quint16)weights[k + 1];
+        }
+        __m128i w = _mm_set1_epi32((wb << 16) | (quint16)weights[k]);
+        __m128i lo = _mm_unpacklo_epi8(a, b);
+        __m128i hi = _mm_unpackhi_epi8(a, b);
+        sum[0] = _mm_add_epi32(sum[0],
+                   _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+        sum[1] = _mm_add_epi32(sum[1],
+                   _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+        sum[2] = _mm_add_epi32(sum[2],
+                   _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+        sum[3] = _mm_add_epi32(sum[3],
+                   _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+      }
+      for (int i = 0; i < 4; i++) {
+        *(quint32*)(out + (x + i) * 4) = packPixel(sum[i]);
+      }
+    }
+    verticalScalar(in, out, weights, count, x, to);
+  }
+#endif
+
+  /**
+   * A range of output rows of one pass, with everything needed to filter
+   * them, so that bands can be filtered on different threads.  The vertical
+   * pass is the one with taps down.
+   */
+  struct Band
+  {
+    const quint8* in;
+    int inStride;
+    quint8* out;
+    int outStride;
+    const Contributions* across;
+    const Contributions* down;
+    int firstRow;
+    int width;
+    int from;
+    int to;
+    bool useSimd;
+  };
+
+  /**
+   * Filters the rows of \a band.  In the horizontal pass, output row y comes
+   * from input row firstRow + y; in the vertical pass, firstRow is the input
+   * row that the first of the vertical taps count from.
+   */
+  void filterBand(Band& band)
+  {
+    if (!band.down) {
+      for (int y = band.from; y < band.to; y++) {
+        const quint8* in = band.in + (band.firstRow + y) * band.inStride;
+        quint8* out = band.out + y * band.outStride;
+#if HAVE_SSE2
+        if (band.useSimd) {
+          horizontalSse2(in, out, *band.across, 0, band.width);
+          continue;
+        }
+#endif
+        horizontalScalar(in, out, *band.across, 0, band.width);
+      }
+      return;
+    }
+
+    const Contributions& down = *band.down;
+    QVector<const quint8*> rows(down.stride);
+    for (int y = band.from; y < band.to; y++) {
+      int first = down.first[y] - band.firstRow;
+      int count = down.count[y];
+      for (int k = 0; k < count; k++) {
+        rows[k] = band.in + (first + k) * band.inStride;
+      }
+      const qint16* weights = down.weights.constData() + y * down.stride;
+      quint8* out = band.out + y * band.outStride;
+#if HAVE_SSE2
+      if (band.useSimd) {
+        verticalSse2(rows.constData(), out, weights, count, 0, band.width);
+        continue;
+      }
+#endif
+      verticalScalar(rows.constData(), out, weights, count, 0, band.width);
+    }
+  }
+
+  /**
+   * Runs the pass described by \a pass over \a rows output rows, a band at
+   * a time across the thread pool
+   */
+  void filterRows(const Band& pass, int rows)
+  {
+    QList<Band> bands;
+    for (int from = 0; from < rows; from += BandRows) {
+      Band band = pass;
+      band.from = from;
+      band.to = qMin(from + BandRows, rows);
+      bands << band;
+    }
+    QtConcurrent::blockingMap(bands, filterBand);
+  }
+}
+
+
+/*!
+ * Returns \a image cropped about its centre to the shape of \a size, and
+ * scaled to exactly that size
+ */
+QImage Resampler::fit(const QImage& image, const QSize& size)
+{
+  if (image.isNull() || size.isEmpty()) {
+    return QImage();
+  }
+
+  // Crop to the target's aspect ratio, keeping the centre of the image
+  QSize cropSize = size.scaled(image.size(), Qt::KeepAspectRatio);
+  QRect sourceRect(QPoint((image.width() - cropSize.width()) / 2,
+                          (image.height() - cropSize.height()) / 2),
+                   cropSize);
+
+#ifndef QT_NO_DEBUG
+  static bool checked = false;
+  if (!checked) {
+    checked = true;
+    Q_ASSERT_X(selfTest(), "Resampler::fit",
+               "SIMD and scalar resampling differ");
+  }
+#endif
+
+  return resample(image, sourceRect, size, HAVE_SSE2);
+}
+
+/*!
+ * Checks that the SIMD kernels give exactly the same result as the scalar
+ * ones, on a noisy test image scaled both down and up.  Always true where
+ * there are no SIMD kernels.
+ */
+bool Resampler::selfTest()
+{
+  QImage image(61, 37, QImage::Format_ARGB32);
+  uint seed = 12345;
+  for (int y = 0; y < image.height(); y++) {
+    QRgb* line = (QRgb*)image.scanLine(y);
+    for (int x = 0; x < image.width(); x++) {
+      seed = seed * 1103515245 + 12345;
+      line[x] = seed;
+    }
+  }
+
+  // Down, up a little (Lanczos), and up a lot (Catmull-Rom)
+  QList<QSize> sizes;
+  sizes << QSize(23, 11) << QSize(80, 45) << QSize(150, 97) <<
+           QSize(61, 37) << QSize(400, 260);
+  foreach (QSize size, sizes) {
+    QRect rect(QPoint(3, 2), QSize(55, 31));
+    if (resample(image, rect, size, true) !=
+        resample(image, rect, size, false)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*!
+ * Scales the part of \a image within \a sourceRect to \a size.  The
+ * horizontal pass runs first, over just the rows of the source rectangle, and
+ * the vertical pass then works from its output.  The images' rows are taken
+ * before either pass starts, so that no thread causes a detach.
+ */
+QImage Resampler::resample(const QImage& image, const QRect& sourceRect,
+                           const QSize& size, bool useSimd)
+{
+  const QImage source = image.convertToFormat(QImage::Format_ARGB32);
+  useSimd = useSimd && HAVE_SSE2;
+
+  Contributions across =
+    contributions(sourceRect.x(), sourceRect.width(), size.width());
+  Contributions down =
+    contributions(sourceRect.y(), sourceRect.height(), size.height());
+
+  // Horizontal pass
+  QImage wide(size.width(), sourceRect.height(), QImage::Format_ARGB32);
+  Band pass;
+  pass.in = source.bits();
+  pass.inStride = source.bytesPerLine();
+  pass.out = wide.bits();
+  pass.outStride = wide.bytesPerLine();
+  pass.across = &across;
+  pass.down = NULL;
+  pass.firstRow = sourceRect.y();
+  pass.width = size.width();
+  pass.from = 0;
+  pass.to = 0;
+  pass.useSimd = useSimd;
+  filterRows(pass, sourceRect.height());
+
+  // Vertical pass
+  QImage result(size, QImage::Format_ARGB32);
+  pass.in = static_cast<const QImage&>(wide).bits();
+  pass.inStride = wide.bytesPerLine();
+  pass.out = result.bits();
+  pass.outStride = result.bytesPerLine();
+  pass.down = &down;
+  filterRows(pass, size.height());
+
+  return result;
+}
@@ -0,0 +1,332 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "retryQueue.h"
+
+namespace
+{
+  // Backoff for each error class starts at the first delay, and doubles
+  // with each failure up to the second.  A wallpaper that isn't published
+  // yet won't be for a while; a machine that is offline may be back soon.
+  const int BaseDelaySecs[] = { 60 * 60, 2 * 60, 10 * 60 };
+  const int MaxDelaySecs[] = { 12 * 60 * 60, 60 * 60, 6 * 60 * 60 };
+
+  // Server errors in a row that trip the breaker
+  const int BreakerThreshold = 3;
+
+  // How long the breaker stays open, doubling each time it trips again
+  // without the server recovering, up to the limit
+  const int BreakerBaseSecs = 30 * 60;
+  const int BreakerMaxSecs = 8 * 60 * 60;
+
+  // A probe that hasn't been heard of for this long is assumed lost, and
+  // another is let through
+  const uint ProbeTimeoutSecs = 15 * 60;
+
+  // Backoff left over from a month long gone is forgotten
+  const uint ForgetSecs = 62 * 24 * 60 * 60;
+
+  /*!
+   * Returns the current time, in seconds since the epoch
+   */
+  uint now()
+  {
+    return QDateTime::currentDateTime().toTime_t();
+  }
+
+  /*!
+   * Returns a random number of seconds between half of \a secs and all of it
+   */
+  int jittered(int secs)
+  {
+    return secs / 2 + (int)((secs / 2 + 1) * (qrand() / (RAND_MAX + 1.0)));
+  }
+}
+
+
+/*!
+ * Constructor
+ */
+RetryQueue::RetryQueue()
+  : mEntries(),
+    mServerFailures(0),
+    mBreakerTrips(0),
+    mBreakerOpenUntil(0),
+    mProbing(false),
+    mProbeKey(),
+    mProbeStarted(0),
+    mAttempts(0),
+    mSuppressed(0),
+    mSuppressedByBreaker(0)
+{
+  for (int i = 0; i <= ServerError; i++) {
+    mFailures[i] = 0;
+  }
+  load();
+}
+
+/*!
+ * Destructor
+ */
+RetryQueue::~RetryQueue()
+{
+  save();
+}
+
+/*!
+ * Returns the class of a failed download, from the error reported by Qt and
+ * the HTTP status (or 0 if there was no response)
+ */
+RetryQueue::ErrorClass RetryQueue::classify(QNetworkReply::NetworkError error,
+                                            int httpStatus)
+{
+  if (httpStatus == 404 || httpStatus == 410 ||
+      error == QNetworkReply::ContentNotFoundError) {
+    return NotPublished;
+  }
+  if (httpStatus >= 500) {
+    return ServerError;
+  }
+
+  switch (error) {
+    // The server couldn't be found or reached from here at all, which says
+    // more about this machine's connection than about the server
+    case QNetworkReply::HostNotFoundError:
+    case QNetworkReply::ProxyConnectionRefusedError:
+    case QNetworkReply::ProxyNotFoundError:
+    case QNetworkReply::ProxyTimeoutError:
+    case QNetworkReply::UnknownNetworkError:
+      return Unreachable;
+    default:
+      return ServerError;
+  }
+}
+
+/*!
+ * Returns whether \a key may be downloaded now, and counts the attempt, or
+ * the suppression if not.  An open breaker holds back every request but the
+ * one sent to see whether the server has recovered.
+ * @param key Name of the file
+ * @param ignoreBackoff If true, only the breaker can hold the request back;
+ *        for when someone has asked for it in person
+ */
+bool RetryQueue::allow(const QString& key, bool ignoreBackoff)
+{
+  uint time = now();
+  bool allowed = true;
+
+  if (mProbing && time >= mProbeStarted + ProbeTimeoutSecs) {
+    mProbing = false;
+  }
+  if (mBreakerOpenUntil != 0) {
+    if (time < mBreakerOpenUntil || mProbing) {
+      mSuppressedByBreaker++;
+      allowed = false;
+    } else {
+      mProbing = true;
+      mProbeKey = key;
+      mProbeStarted = time;
+    }
+  }
+  if (allowed && !ignoreBackoff && mEntries.contains(key) &&
+      time < mEntries[key].notBefore) {
+    allowed = false;
+  }
+
+  // Only the counts change here, and they are saved along with the next
+  // outcome, or on exit
+  if (allowed) {
+    mAttempts++;
+  } else {
+    mSuppressed++;
+  }
+  return allowed;
+}
+
+/*!
+ * Records that \a key was fetched, or found to be current, which also shows
+ * that the server is working
+ */
+void RetryQueue::recordSuccess(const QString& key)
+{
+  mEntries.remove(key);
+  mServerFailures = 0;
+  mBreakerTrips = 0;
+  mBreakerOpenUntil = 0;
+  mProbing = false;
+  save();
+}
+
+/*!
+ * Records that \a key failed to download, and sets when it may be tried
+ * again
+ */
+void RetryQueue::recordFailure(const QString& key, ErrorClass errorClass)
+{
+  uint time = now();
+  Entry& entry = mEntries[key];
+  int delaySecs = qMin(BaseDelaySecs[errorClass] << qMin(entry.failures, 10),
+                       MaxDelaySecs[errorClass]);
+  entry.failures++;
+  entry.errorClass = errorClass;
+  entry.notBefore = time + jittered(delaySecs);
+  mFailures[errorClass]++;
+
+  if (errorClass == ServerError) {
+    mServerFailures++;
+    if (mProbing || mServerFailures >= BreakerThreshold) {
+      int openSecs = qMin(BreakerBaseSecs << qMin(mBreakerTrips, 10),
+                          BreakerMaxSecs);
+      mBreakerTrips++;
+      mBreakerOpenUntil = time + jittered(openSecs);
+      qWarning() << "Too many server errors; holding back requests until" <<
+                    QDateTime::fromTime_t(mBreakerOpenUntil).toString();
+    }
+  }
+  mProbing = false;
+  save();
+}
+
+/*!
+ * Records that the request for \a key ended without showing whether the
+ * server works, because it was cancelled or failed on our side.  If it was
+ * the breaker's probe, another may be sent.
+ */
+void RetryQueue::release(const QString& key)
+{
+  if (mProbing && key == mProbeKey) {
+    mProbing = false;
+  }
+}
+
+/*!
+ * Returns true while the breaker is holding back requests
+ */
+bool RetryQueue::isBreakerOpen() const
+{
+  return mBreakerOpenUntil != 0 && (now() < mBreakerOpenUntil || mProbing);
+}
+
+/*!
+ * Returns the earliest time at which any of \a keys may be tried again, or
+ * a null time if none of them is being held back
+ */
+QDateTime RetryQueue::nextAttempt(const QStringList& keys) const
+{
+  uint earliest = 0;
+  foreach (QString key, keys) {
+    if (mEntries.contains(key) &&
+        (earliest == 0 || mEntries[key].notBefore < earliest)) {
+      earliest = mEntries[key].notBefore;
+    }
+  }
+  earliest = qMax(earliest, mBreakerOpenUntil);
+  if (earliest <= now()) {
+    return QDateTime();
+  }
+  return QDateTime::fromTime_t(earliest);
+}
+
+/*!
+ * Returns a one-line summary of the attempts made and held back
+ */
+QString RetryQueue::report() const
+{
+  return QString("%1 attempts, %2 suppressed (%3 by the breaker); "
+                 "failures: %4 not published, %5 unreachable, "
+                 "%6 server errors").
+           arg(mAttempts).arg(mSuppressed).arg(mSuppressedByBreaker).
+           arg(mFailures[NotPublished]).arg(mFailures[Unreachable]).
+           arg(mFailures[ServerError]);
+}
+
+/*!
+ * Loads the state kept from earlier runs
+ */
+void RetryQueue::load()
+{
+  QSettings settings;
+  uint time = now();
+  int count = settings.beginReadArray("retryQueue");
+  for (int i = 0; i < count; i++) {
+    settings.setArrayIndex(i);
+    Entry entry;
+    entry.failures = settings.value("failures").toInt();
+    entry.errorClass = (ErrorClass)qBound(
+      0, settings.value("errorClass").toInt(), (int)ServerError);
+    entry.notBefore = settings.value("notBefore").toUInt();
+    if (entry.notBefore + ForgetSecs > time) {
+      mEntries.insert(settings.value("key").toString(), entry);
+    }
+  }
+  settings.endArray();
+
+  settings.beginGroup("retryStats");
+  mServerFailures = settings.value("serverFailures").toInt();
+  mBreakerTrips = settings.value("breakerTrips").toInt();
+  mBreakerOpenUntil = settings.value("breakerOpenUntil").toUInt();
+  mAttempts = settings.value("attempts").toLongLong();
+  mSuppressed = settings.value("suppressed").toLongLong();
+  mSuppressedByBreaker = settings.value("suppressedByBreaker").toLongLong();
+  mFailures[NotPublished] = settings.value("notPublished").toLongLong();
+  mFailures[Unreachable] = settings.value("unreachable").toLongLong();
+  mFailures[ServerError] = settings.value("serverErrors").toLongLong();
+  settings.endGroup();
+}
+
+/*!
+ * Stores the state for next time
+ */
+void RetryQueue::save() const
+{
+  QSettings settings;
+  settings.beginWriteArray("retryQueue", mEntries.size());
+  int i = 0;
+  QHashIterator<QString, Entry> iter(mEntries);
+  while (iter.hasNext()) {
+    iter.next();
+    settings.setArrayIndex(i++);
+    settings.setValue("key", iter.key());
+    settings.setValue("failures", iter.value().failures);
+    settings.setValue("errorClass", (int)iter.value().errorClass);
+    settings.setValue("notBefore", iter.value().notBefore);
+  }
+  settings.endArray();
+
+  settings.beginGroup("retryStats");
+  settings.setValue("serverFailures", mServerFailures);
+  settings.setValue("breakerTrips", mBreakerTrips);
+  settings.setValue("breakerOpenUntil", mBreakerOpenUntil);
+  settings.setValue("attempts", mAttempts);
+  settings.setValue("suppressed", mSuppressed);
+  settings.setValue("suppressedByBreaker", mSuppressedByBreaker);
+  settings.setValue("notPublished", mFailures[NotPublished]);
+  settings.setValue("unreachable", mFailures[Unreachable]);
+  settings.setValue("serverErrors", mFailures[ServerError]);
+  settings.endGroup();
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RETRYQUEUE_H
+#define RETRYQUEUE_H
+
+#include <QtNetwork>
+
+
+/*!
+ * Decides when a file that failed to download may be asked for again, so
+ * that during an outage the machines running this application back off
+ * instead of all asking the server every few minutes.  Each file backs off
+ * exponentially, with random jitter, from a starting delay that depends on
+ * how it failed.  Failures that suggest the server itself is in trouble also
+ * count towards a circuit breaker, which once tripped holds back every
+ * request for a while, and then lets a single one through to see whether
+ * the server has recovered.  Every request let through must end in
+ * recordSuccess(), recordFailure() or release(), or the breaker can't let
+ * another probe through until the last has been given up for lost.
+ *
+ * Everything is kept in the settings, along with counts of the attempts
+ * made and held back, so that backoff survives restarts.
+ */
+class RetryQueue
+{
+  public:
+    enum ErrorClass { NotPublished, Unreachable, ServerError };
+
+    RetryQueue();
+    ~RetryQueue();
+    static ErrorClass classify(QNetworkReply::NetworkError error,
+                               int httpStatus);
+    bool allow(const QString& key, bool ignoreBackoff);
+    void recordSuccess(const QString& key);
+    void recordFailure(const QString& key, ErrorClass errorClass);
+    void release(const QString& key);
+    bool isBreakerOpen() const;
+    QDateTime nextAttempt(const QStringList& keys) const;
+    QString report() const;
+
+  private:
+    struct Entry
+    {
+      Entry() : failures(0), errorClass(ServerError), notBefore(0) {}
+
+      int failures;
+      ErrorClass errorClass;
+      uint notBefore;
+    };
+
+    QHash<QString, Entry> mEntries;
+    int mServerFailures;
+    int mBreakerTrips;
+    uint mBreakerOpenUntil;
+    bool mProbing;
+    QString mProbeKey;
+    uint mProbeStarted;
+    qint64 mAttempts;
+    qint64 mSuppressed;
+    qint64 mSuppressedByBreaker;
+    qint64 mFailures[ServerError + 1];
+
+    void load();
+    void save() const;
+};
+
+#endif
@@ -0,0 +1,190 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "sha256.h"
+#include <string.h>
+
+namespace
+{
+  const quint32 RoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+  inline quint32 rotateRight(quint32 value, int bits)
+  {
+    return (value >> bits) | (value << (32 - bits));
+  }
+}
+
+
+/*!
+ * Constructor
+ */
+Sha256::Sha256()
+{
+  reset();
+}
+
+/*!
+ * Destructor
+ */
+Sha256::~Sha256()
+{
+}
+
+/*!
+ * Discards any data added so far
+ */
+void Sha256::reset()
+{
+  static const quint32 initialState[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  for (int i = 0; i < 8; i++) {
+    mState[i] = initialState[i];
+  }
+  mBlockLength = 0;
+  mLength = 0;
+}
+
+/*!
+ * Adds \a length bytes at \a data to the hash
+ */
+void Sha256::addData(const char* data, int length)
+{
+  const uchar* in = (const uchar*)data;
+  mLength += length;
+
+  // Top up a partly filled block first
+  if (mBlockLength > 0) {
+    int count = qMin(length, 64 - mBlockLength);
+    memcpy(mBlock + mBlockLength, in, count);
+    mBlockLength += count;
+    in += count;
+    length -= count;
+    if (mBlockLength < 64) {
+      return;
+    }
+    processBlock(mBlock);
+    mBlockLength = 0;
+  }
+
+  while (length >= 64) {
+    processBlock(in);
+    in += 64;
+    length -= 64;
+  }
+
+  memcpy(mBlock, in, length);
+  mBlockLength = length;
+}
+
+/*!
+ * Returns the hash of the data added so far, as 32 raw bytes.  More data may
+ * still be added afterwards.
+ */
+QByteArray Sha256::result() const
+{
+  Sha256 copy(*this);
+
+  // Pad to 56 bytes into a block, then append the length in bits
+  quint64 bits = mLength * 8;
+  uchar padding[72];
+  int padLength = (mBlockLength < 56) ? 56 - mBlockLength :
+                                        120 - mBlockLength;
+  memset(padding, 0, sizeof(padding));
+  padding[0] = 0x80;
+  for (int i = 0; i < 8; i++) {
+    padding[padLength + i] = (uchar)(bits >> (56 - 8 * i));
+  }
+  copy.addData((const char*)padding, padLength + 8);
+
+  QByteArray digest(32, 0);
+  for (int i = 0; i < 32; i++) {
+    digest[i] = (char)(copy.mState[i / 4] >> (24 - 8 * (i % 4)));
+  }
+  return digest;
+}
+
+/*!
+ * Mixes one 64-byte block into the state
+ */
+void Sha256::processBlock(const uchar* block)
+{
+  quint32 w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = ((quint32)block[i * 4] << 24) | ((quint32)block[i * 4 + 1] << 16) |
+           ((quint32)block[i * 4 + 2] << 8) | (quint32)block[i * 4 + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    quint32 s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^
+                 (w[i - 15] >> 3);
+    quint32 s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^
+                 (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  quint32 a = mState[0], b = mState[1], c = mState[2], d = mState[3];
+  quint32 e = mState[4], f = mState[5], g = mState[6], h = mState[7];
+  for (int i = 0; i < 64; i++) {
+    quint32 s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+    quint32 choice = (e & f) ^ (~e & g);
+    quint32 t1 = h + s1 + choice + RoundConstants[i] + w[i];
+    quint32 s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+    quint32 majority = (a & b) ^ (a & c) ^ (b & c);
+    quint32 t2 = s0 + majority;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  mState[0] += a;
+  mState[1] += b;
+  mState[2] += c;
+  mState[3] += d;
+  mState[4] += e;
+  mState[5] += f;
+  mState[6] += g;
+  mState[7] += h;
+}
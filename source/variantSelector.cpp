@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "variantSelector.h"
+
+
+/*!
+ * Constructor
+ * \a variants The available resolutions, in the form "<width>x<height>"
+ */
+VariantSelector::VariantSelector(const QStringList& variants)
+  : mVariants()
+{
+  foreach (QString variant, variants) {
+    if (parseVariant(variant).isValid()) {
+      mVariants << variant;
+    }
+  }
+  if (mVariants.isEmpty()) {
+    mVariants = defaultVariants();
+  }
+}
+
+/*!
+ * Destructor
+ */
+VariantSelector::~VariantSelector()
+{
+}
+
+/*!
+ * Returns the resolutions every wallpaper has been published in so far
+ */
+QStringList VariantSelector::defaultVariants()
+{
+  return QStringList() << "1280x800" << "1280x960";
+}
+
+/*!
+ * Parses a resolution of the form "<width>x<height>"
+ * \returns an invalid size if \a variant is malformed
+ */
+QSize VariantSelector::parseVariant(const QString& variant)
+{
+  QStringList parts = variant.split('x');
+  if (parts.size() != 2) {
+    return QSize();
+  }
+  bool widthOk, heightOk;
+  QSize size(parts[0].toInt(&widthOk), parts[1].toInt(&heightOk));
+  if (!widthOk || !heightOk || size.isEmpty()) {
+    return QSize();
+  }
+  return size;
+}
+
+/*!
+ * Scores how well an image of size \a variant would fill \a screen; lower is
+ * better, and 0 is a perfect fit.
+ */
+double VariantSelector::score(const QSize& variant, const QSize& screen)
+{
+  double variantRatio = (double)variant.width() / variant.height();
+  double screenRatio = (double)screen.width() / screen.height();
+
+  // Fraction of the image lost when cropping it to the screen's shape
+  double cropLoss = 1.0 - qMin(variantRatio / screenRatio,
+                               screenRatio / variantRatio);
+
+  // How much the image must be scaled by to cover the whole screen
+  double scale = qMax((double)screen.width() / variant.width(),
+                      (double)screen.height() / variant.height());
+  double upscale = qMax(0.0, scale - 1.0);
+  double oversize = qMax(0.0, 1.0 / scale - 1.0);
+
+  return 4.0 * cropLoss + 2.0 * upscale + 0.25 * oversize;
+}
+
+/*!
+ * Returns the variant that best suits \a screen
+ */
+QString VariantSelector::bestFor(const QSize& screen) const
+{
+  QString best;
+  double bestScore = 0;
+  foreach (QString variant, mVariants) {
+    double variantScore = score(parseVariant(variant), screen);
+    if (best.isEmpty() || variantScore < bestScore) {
+      best = variant;
+      bestScore = variantScore;
+    }
+  }
+  return best;
+}
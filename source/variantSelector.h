@@ -0,0 +1,59 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VARIANTSELECTOR_H
+#define VARIANTSELECTOR_H
+
+#include <QtCore>
+
+
+/*!
+ * Chooses which of the published resolutions of a wallpaper best suits a
+ * screen.  Each variant is scored by how much of the image would have to be
+ * cropped to fill the screen, how far it would have to be enlarged (which
+ * makes it blurry), and, to a lesser degree, how much larger it is than
+ * needed (which wastes bandwidth).  The lowest score wins.
+ *
+ * If none of the variants given are well-formed, the resolutions that have
+ * always been published are used instead (see defaultVariants()).
+ */
+class VariantSelector
+{
+  public:
+    explicit VariantSelector(const QStringList& variants);
+    ~VariantSelector();
+    static QStringList defaultVariants();
+    static QSize parseVariant(const QString& variant);
+    static double score(const QSize& variant, const QSize& screen);
+    QString bestFor(const QSize& screen) const;
+
+  private:
+    QStringList mVariants;
+};
+
+#endif
@@ -27,54 +27,366 @@
  */
 
 #include "versionNumber.h"
-#include <algorithm>
+#include "defines.h"
+#include <string.h>
+
+namespace
+{
+  const int BitsPerPart = 16;
+  const int MaxPart = 0xffff;
+
+  inline ushort code(char c)
+  {
+    return (uchar)c;
+  }
+
+  inline ushort code(QChar c)
+  {
+    return c.unicode();
+  }
+
+  inline bool isDigit(ushort c)
+  {
+    return c >= '0' && c <= '9';
+  }
+
+  inline bool isSpace(ushort c)
+  {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+  }
+
+  /*!
+   * Returns true if the \a length characters at \a s are all digits
+   */
+  bool isNumeric(const char* s, int length)
+  {
+    for (int i = 0; i < length; i++) {
+      if (!isDigit(code(s[i]))) {
+        return false;
+      }
+    }
+    return true;
+  }
+}
 
 
 /*!
-  * Constructor
-  */
-VersionNumber::VersionNumber(QString versionString)
-  : mChunks(versionString.split('.'))
+ * Constructs an invalid version, which compares equal to 0
+ */
+VersionNumber::VersionNumber()
+  : mParts(0),
+    mValid(false)
 {
-  // Remove any trailing chunks that equate to zero
-  bool isInt;
-  int chunkInt;
-  bool isZeroChunk = true;
-  while (!mChunks.isEmpty() && isZeroChunk) {
-    chunkInt = mChunks.last().toInt(&isInt);
-    if (isInt && chunkInt == 0) {
-      mChunks.removeLast();
-    } else {
-      isZeroChunk = false;
-    }
+  mPreRelease[0] = '\0';
+}
+
+/*!
+ * Constructor; parses \a versionString
+ */
+VersionNumber::VersionNumber(const QString& versionString)
+  : mParts(0),
+    mValid(false)
+{
+  parse(versionString.constData(), versionString.size());
+}
+
+/*!
+ * Constructor; parses \a versionString
+ */
+VersionNumber::VersionNumber(const char* versionString)
+  : mParts(0),
+    mValid(false)
+{
+  parse(versionString, versionString ? (int)strlen(versionString) : 0);
+}
+
+/*!
+ * Constructs the release version \a part1.\a part2.\a part3.\a part4 without
+ * any parsing
+ */
+VersionNumber::VersionNumber(int part1, int part2, int part3, int part4)
+  : mParts(0),
+    mValid(true)
+{
+  int parts[PartCount] = {part1, part2, part3, part4};
+  for (int i = 0; i < PartCount; i++) {
+    mParts = (mParts << BitsPerPart) | (quint64)qBound(0, parts[i], MaxPart);
   }
+  mPreRelease[0] = '\0';
 }
 
 /*!
-  * Destructor
-  */
+ * Destructor
+ */
 VersionNumber::~VersionNumber()
 {
 }
 
 /*!
- * Compares \a v1 with \a v2 and returs an integer less than, equal to, or
- * greater than v2.
+ * Returns the version of this application, parsed just the once
+ */
+const VersionNumber& VersionNumber::application()
+{
+  static const VersionNumber version(APP_VERSION);
+  return version;
+}
+
+/*!
+ * Returns numeric part \a index, counting from 0, or 0 if there is none
+ */
+int VersionNumber::part(int index) const
+{
+  if (index < 0 || index >= PartCount) {
+    return 0;
+  }
+  int shift = (PartCount - 1 - index) * BitsPerPart;
+  return (int)((mParts >> shift) & MaxPart);
+}
+
+/*!
+ * Returns the version as a string, without any trailing zero parts or build
+ * metadata
+ */
+QString VersionNumber::toString() const
+{
+  int count = PartCount;
+  while (count > 1 && part(count - 1) == 0) {
+    count--;
+  }
+  QString result = QString::number(part(0));
+  for (int i = 1; i < count; i++) {
+    result += '.' + QString::number(part(i));
+  }
+  if (mPreRelease[0] != '\0') {
+    result += '-' + QString::fromLatin1(mPreRelease);
+  }
+  return result;
+}
+
+/*!
+ * Compares \a v1 with \a v2 and returns an integer less than, equal to, or
+ * greater than zero if v1 is less than, equal to, or greater than v2.
  */
 int VersionNumber::compare(const VersionNumber& v1, const VersionNumber& v2)
 {
-  int vCounts[2] = {v1.mChunks.count(), v2.mChunks.count()};
-  int numChunksToCompare = std::min(vCounts[0], vCounts[1]);
-  int diff = 0;
+  if (v1.mParts != v2.mParts) {
+    return (v1.mParts < v2.mParts) ? -1 : 1;
+  }
+  return comparePreRelease(v1.mPreRelease, v2.mPreRelease);
+}
 
-  for (int i = 0; i < numChunksToCompare && diff == 0; i++) {
-    diff = QString::compare(v1.mChunks[i], v2.mChunks[i]);
+/*!
+ * Reads the \a length characters at \a data.  The version is left invalid,
+ * and equal to 0, if they don't make one.
+ */
+template<class Char>
+void VersionNumber::parse(const Char* data, int length)
+{
+  mPreRelease[0] = '\0';
+  int i = 0;
+  while (i < length && isSpace(code(data[i]))) {
+    i++;
+  }
+  while (length > i && isSpace(code(data[length - 1]))) {
+    length--;
+  }
+  if (i < length && (code(data[i]) == 'v' || code(data[i]) == 'V')) {
+    i++;
+  }
+
+  // Numeric parts; any beyond the fourth are ignored
+  quint64 parts = 0;
+  int count = 0;
+  forever {
+    if (i >= length || !isDigit(code(data[i]))) {
+      return;
+    }
+    int value = 0;
+    while (i < length && isDigit(code(data[i]))) {
+      value = qMin(value * 10 + (code(data[i]) - '0'), MaxPart);
+      i++;
+    }
+    if (count < PartCount) {
+      parts = (parts << BitsPerPart) | (quint64)value;
+      count++;
+    }
+    if (i < length && code(data[i]) == '.') {
+      i++;
+    } else {
+      break;
+    }
   }
+  parts <<= (PartCount - count) * BitsPerPart;
 
-  if (diff == 0) {
-    // If one list is longer, it has a higher version number
-    diff = vCounts[0] - vCounts[1];
+  // Pre-release tag, which may only hold ASCII letters, digits, '-' and '.'
+  char preRelease[PreReleaseSize];
+  int tagLength = 0;
+  if (i < length && code(data[i]) == '-') {
+    i++;
+    while (i < length && code(data[i]) != '+') {
+      ushort c = code(data[i]);
+      if (!isDigit(c) && !(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z') &&
+          c != '-' && c != '.') {
+        return;
+      }
+      if (tagLength < PreReleaseSize - 1) {
+        preRelease[tagLength++] = (char)c;
+      }
+      i++;
+    }
+    if (tagLength == 0) {
+      return;
+    }
   }
 
-  return diff;
+  // Build metadata counts for nothing
+  if (i < length && code(data[i]) != '+') {
+    return;
+  }
+
+  mParts = parts;
+  memcpy(mPreRelease, preRelease, tagLength);
+  mPreRelease[tagLength] = '\0';
+  mValid = true;
+}
+
+/*!
+ * Compares the pre-release tags \a a and \a b as semantic versioning orders
+ * them: no tag at all comes last; otherwise the dot-separated fields are
+ * compared in turn, numbers by value and anything else in ASCII order, with
+ * numbers before words, and a tag with more fields after one without.
+ */
+int VersionNumber::comparePreRelease(const char* a, const char* b)
+{
+  if (*a == '\0' || *b == '\0') {
+    return (*a == '\0' ? 0 : -1) + (*b == '\0' ? 0 : 1);
+  }
+
+  forever {
+    int lengthA = (int)strcspn(a, ".");
+    int lengthB = (int)strcspn(b, ".");
+    bool numericA = isNumeric(a, lengthA);
+    bool numericB = isNumeric(b, lengthB);
+
+    int diff;
+    if (numericA != numericB) {
+      diff = numericA ? -1 : 1;
+    } else {
+      // Leading zeros aside, a longer number is a larger one
+      diff = numericA ? lengthA - lengthB : 0;
+      if (diff == 0) {
+        diff = strncmp(a, b, qMin(lengthA, lengthB));
+      }
+      if (diff == 0) {
+        diff = lengthA - lengthB;
+      }
+    }
+    if (diff != 0) {
+      return diff;
+    }
+
+    a += lengthA;
+    b += lengthB;
+    if (*a == '\0' || *b == '\0') {
+      return (*a == '\0' ? 0 : 1) - (*b == '\0' ? 0 : 1);
+    }
+    a++;
+    b++;
+  }
+}
+
+
+/*!
+ * Constructor; parses \a range.  If any of it can't be understood, the range
+ * is left invalid, and contains nothing.  An alternative with no comparisons
+ * would contain everything, so unless it is the whole range, it is taken for
+ * a mistake.
+ */
+VersionRange::VersionRange(const QString& range)
+  : mAlternatives(),
+    mValid(true)
+{
+  foreach (QString alternative, range.split("||")) {
+    QList<Bound> bounds;
+    foreach (QString term, alternative.split(' ', QString::SkipEmptyParts)) {
+      Bound bound;
+      int opLength = 0;
+      if (term.startsWith("<=")) {
+        bound.op = LessOrEqual;
+        opLength = 2;
+      } else if (term.startsWith(">=")) {
+        bound.op = GreaterOrEqual;
+        opLength = 2;
+      } else if (term.startsWith("==")) {
+        bound.op = Equal;
+        opLength = 2;
+      } else if (term.startsWith('<')) {
+        bound.op = Less;
+        opLength = 1;
+      } else if (term.startsWith('>')) {
+        bound.op = Greater;
+        opLength = 1;
+      } else {
+        bound.op = Equal;
+        opLength = term.startsWith('=') ? 1 : 0;
+      }
+      bound.version = VersionNumber(term.mid(opLength));
+      if (!bound.version.isValid()) {
+        mValid = false;
+      }
+      bounds << bound;
+    }
+    if (bounds.isEmpty() && !range.trimmed().isEmpty()) {
+      mValid = false;
+    }
+    mAlternatives << bounds;
+  }
+}
+
+/*!
+ * Destructor
+ */
+VersionRange::~VersionRange()
+{
+}
+
+/*!
+ * Returns true if \a version is in the range
+ */
+bool VersionRange::contains(const VersionNumber& version) const
+{
+  if (!mValid) {
+    return false;
+  }
+  foreach (const QList<Bound>& bounds, mAlternatives) {
+    bool matches = true;
+    foreach (const Bound& bound, bounds) {
+      int diff = VersionNumber::compare(version, bound.version);
+      switch (bound.op) {
+        case Less:
+          matches = (diff < 0);
+          break;
+        case LessOrEqual:
+          matches = (diff <= 0);
+          break;
+        case Greater:
+          matches = (diff > 0);
+          break;
+        case GreaterOrEqual:
+          matches = (diff >= 0);
+          break;
+        case Equal:
+        default:
+          matches = (diff == 0);
+          break;
+      }
+      if (!matches) {
+        break;
+      }
+    }
+    if (matches) {
+      return true;
+    }
+  }
+  return false;
 }
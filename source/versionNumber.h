@@ -33,24 +33,91 @@
 
 
 /*!
- * VersionNumber number class for easy comparison of version numbers
+ * VersionNumber number class for easy comparison of version numbers.
+ *
+ * Versions take the form "1.2.3", with up to four numeric parts, optionally
+ * followed by a semantic-versioning pre-release tag ("1.3-beta.2") and build
+ * metadata ("1.3+20110701").  Parts are compared as numbers, so 1.10 comes
+ * after 1.9, and missing parts count as zero, so 1.3 and 1.3.0 are equal.  A
+ * pre-release comes before the release itself; build metadata is ignored.
+ *
+ * The version is parsed once into a packed form, so comparisons are cheap
+ * and allocate nothing.  Parts over 65535 are held as 65535, and only the
+ * first 15 characters of a pre-release tag are kept.
  */
 class VersionNumber
 {
   public:
-    explicit VersionNumber(QString versionString);
+    VersionNumber();
+    explicit VersionNumber(const QString& versionString);
+    explicit VersionNumber(const char* versionString);
+    VersionNumber(int part1, int part2, int part3 = 0, int part4 = 0);
     ~VersionNumber();
+    static const VersionNumber& application();
+    bool isValid() const { return mValid; }
+    int part(int index) const;
+    QString toString() const;
     static int compare(const VersionNumber& v1, const VersionNumber& v2);
     int compare(const VersionNumber& v) const { return compare(*this, v); }
     bool operator==(const VersionNumber& rhs) const
     {
       return compare(rhs) == 0;
     }
+    bool operator!=(const VersionNumber& rhs) const
+    {
+      return compare(rhs) != 0;
+    }
     bool operator<(const VersionNumber& rhs) const { return compare(rhs) < 0; }
     bool operator>(const VersionNumber& rhs) const { return compare(rhs) > 0; }
+    bool operator<=(const VersionNumber& rhs) const
+    {
+      return compare(rhs) <= 0;
+    }
+    bool operator>=(const VersionNumber& rhs) const
+    {
+      return compare(rhs) >= 0;
+    }
 
   private:
-    QStringList mChunks;
+    enum { PartCount = 4, PreReleaseSize = 16 };
+
+    // The numeric parts, 16 bits each, the first in the top bits
+    quint64 mParts;
+    // Nul-terminated; empty for a release
+    char mPreRelease[PreReleaseSize];
+    bool mValid;
+
+    template<class Char>
+      void parse(const Char* data, int length);
+    static int comparePreRelease(const char* a, const char* b);
+};
+
+
+/*!
+ * A set of versions, such as ">=1.3 <2", for targeting an update at the
+ * versions it applies to.  Each comparison (<, <=, >, >=, or = which may be
+ * left out) must hold; alternatives may be given with "||", as in
+ * "<1.2 || >=1.4".  An empty range contains every version, but an empty
+ * alternative, as in "<1.2 ||", makes the range invalid.
+ */
+class VersionRange
+{
+  public:
+    explicit VersionRange(const QString& range);
+    ~VersionRange();
+    bool isValid() const { return mValid; }
+    bool contains(const VersionNumber& version) const;
+
+  private:
+    enum Operator { Less, LessOrEqual, Greater, GreaterOrEqual, Equal };
+    struct Bound
+    {
+      Operator op;
+      VersionNumber version;
+    };
+
+    QList<QList<Bound> > mAlternatives;
+    bool mValid;
 };
 
 #endif
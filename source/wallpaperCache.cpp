@@ -0,0 +1,244 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "wallpaperCache.h"
+#include "atomicFile.h"
+#include "diskQueue.h"
+
+
+/*!
+ * Constructor
+ * \a path Directory holding the cached files and their index
+ */
+WallpaperCache::WallpaperCache(const QString& path)
+  : mDir(path),
+    mIndex(mDir.filePath(CacheIndex::IndexFileName)),
+    mBudget(50 * 1024 * 1024),
+    mMaxAgeDays(366),
+    mDiskQueue(NULL)
+{
+}
+
+/*!
+ * Destructor
+ */
+WallpaperCache::~WallpaperCache()
+{
+}
+
+/*!
+ * Hands file operations over to \a queue, to be done in the background
+ */
+void WallpaperCache::setDiskQueue(DiskQueue* queue)
+{
+  mDiskQueue = queue;
+  mIndex.setDiskQueue(queue);
+}
+
+/*!
+ * Returns the name under which the wallpaper for the given month, year and
+ * resolution is both published and cached
+ */
+QString WallpaperCache::fileName(int month, int year,
+                                 const QString& resolution)
+{
+  return QString("%1-%2-%3.jpg").
+           arg(month, 2, 10, QChar('0')).arg(year).arg(resolution);
+}
+
+/*!
+ * Returns what the index knows about the cached file \a name
+ */
+CacheIndex::Entry WallpaperCache::entry(const QString& name) const
+{
+  return mIndex.entry(name);
+}
+
+/*!
+ * Returns the total size of everything in the index
+ */
+qint64 WallpaperCache::totalSize() const
+{
+  qint64 total = 0;
+  foreach (QString name, mIndex.names()) {
+    total += mIndex.entry(name).size;
+  }
+  return total;
+}
+
+/*!
+ * Records a file that has just been written into the cache directory, then
+ * evicts other entries as necessary to stay within the budget.  The new entry
+ * itself is never evicted by this call.
+ * \returns false if the index could not be written
+ */
+bool WallpaperCache::insert(const QString& name, CacheIndex::Entry entry)
+{
+  entry.lastUsed = QDateTime::currentDateTime().toTime_t();
+  entry.checked = entry.lastUsed;
+  // A new version of a file is on the same desktops as the old one
+  entry.pinnedBy = mIndex.entry(name).pinnedBy;
+
+  // Once a download is complete, its partial file is gone
+  mIndex.removeEntry(QFileInfo(AtomicFile::tempFileName(name)).fileName());
+
+  if (!mIndex.setEntry(name, entry)) {
+    return false;
+  }
+  evict(name);
+  return true;
+}
+
+/*!
+ * Marks the cached file \a name as having just been used
+ */
+void WallpaperCache::touch(const QString& name)
+{
+  CacheIndex::Entry entry = mIndex.entry(name);
+  if (entry.isValid()) {
+    entry.lastUsed = QDateTime::currentDateTime().toTime_t();
+    mIndex.setEntry(name, entry);
+  }
+}
+
+/*!
+ * Records that the server has just confirmed the cached file \a name is
+ * current
+ */
+void WallpaperCache::markChecked(const QString& name)
+{
+  CacheIndex::Entry entry = mIndex.entry(name);
+  if (entry.isValid()) {
+    entry.checked = QDateTime::currentDateTime().toTime_t();
+    mIndex.setEntry(name, entry);
+  }
+}
+
+/*!
+ * Records that \a user now has the cached files \a names on the desktop, and
+ * no longer any others
+ */
+void WallpaperCache::pin(const QStringList& names, const QString& user)
+{
+  QByteArray pin = user.toUtf8();
+  pin.replace(',', '_').replace('\t', '_').replace('\n', '_');
+
+  foreach (QString name, mIndex.names()) {
+    CacheIndex::Entry entry = mIndex.entry(name);
+    QList<QByteArray> pins = entry.pinnedBy.split(',');
+    pins.removeAll(QByteArray());
+    bool wasPinned = pins.contains(pin);
+    bool isPinned = names.contains(name);
+    if (wasPinned == isPinned) {
+      continue;
+    }
+    if (isPinned) {
+      pins << pin;
+    } else {
+      pins.removeAll(pin);
+    }
+    QByteArray pinnedBy;
+    foreach (const QByteArray& p, pins) {
+      pinnedBy += (pinnedBy.isEmpty() ? "" : ",") + p;
+    }
+    entry.pinnedBy = pinnedBy;
+    mIndex.setEntry(name, entry);
+  }
+}
+
+/*!
+ * Removes the cached file \a name
+ */
+void WallpaperCache::remove(const QString& name)
+{
+  if (mDiskQueue) {
+    mDiskQueue->removeFiles(QStringList() << filePath(name));
+  } else {
+    mDir.remove(name);
+  }
+  mIndex.removeEntry(name);
+}
+
+/*!
+ * Removes everything from the cache, for use when it has been corrupted.
+ * This is the one operation that scans the directory, so that stray files the
+ * index doesn't know about are removed as well.
+ */
+void WallpaperCache::clear()
+{
+  mIndex.clear();
+
+  if (mDiskQueue) {
+    mDiskQueue->clearDirectory(mDir.path(),
+                               QStringList() << CacheIndex::IndexFileName);
+    return;
+  }
+
+  // (This list will just be empty if the directory doesn't exist)
+  QStringList entries = mDir.entryList(QDir::Files);
+  foreach (QString entry, entries) {
+    // Locks belong to whoever holds them, which may be another process
+    if (entry != CacheIndex::IndexFileName && !entry.endsWith(".lock")) {
+      mDir.remove(entry);
+    }
+  }
+}
+
+/*!
+ * Removes entries that haven't been used within the maximum age, then the
+ * least recently used entries until the cache fits within its budget.
+ * \a keepName is never removed, and nor are entries on someone's desktop
+ * unless they are too old.
+ */
+void WallpaperCache::evict(const QString& keepName)
+{
+  // Order the candidates by when they were last used, oldest first
+  QMultiMap<uint, QString> byLastUsed;
+  foreach (QString name, mIndex.names()) {
+    if (name != keepName) {
+      byLastUsed.insert(mIndex.entry(name).lastUsed, name);
+    }
+  }
+
+  uint cutOff = QDateTime::currentDateTime().addDays(-mMaxAgeDays).toTime_t();
+  qint64 total = totalSize();
+
+  QMapIterator<uint, QString> i(byLastUsed);
+  while (i.hasNext()) {
+    i.next();
+    if (i.key() >= cutOff && total <= mBudget) {
+      break;
+    }
+    CacheIndex::Entry entry = mIndex.entry(i.value());
+    if (i.key() >= cutOff && !entry.pinnedBy.isEmpty()) {
+      continue;
+    }
+    total -= entry.size;
+    remove(i.value());
+  }
+}
@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WALLPAPERCACHE_H
+#define WALLPAPERCACHE_H
+
+#include <QtCore>
+#include "cacheIndex.h"
+
+class DiskQueue;
+
+
+/*!
+ * The on-disk store of downloaded wallpapers.  Several months and resolutions
+ * may be held at once; when the total size exceeds the budget, or an entry
+ * hasn't been used for too long, the least recently used entries are evicted.
+ * Files that a user has on the desktop are pinned, and only evicted once
+ * they are too old; in a shared cache, these may belong to other users.
+ * All bookkeeping is done through the index, so the directory itself never
+ * needs to be scanned.  Given a disk queue, files are deleted in the
+ * background.
+ */
+class WallpaperCache
+{
+  public:
+    explicit WallpaperCache(const QString& path);
+    ~WallpaperCache();
+    static QString fileName(int month, int year, const QString& resolution);
+    QDir dir() const { return mDir; }
+    void setShared(bool shared) { mIndex.setShared(shared); }
+    void setDiskQueue(DiskQueue* queue);
+    QString filePath(const QString& name) const { return mDir.filePath(name); }
+    CacheIndex::Entry entry(const QString& name) const;
+    void setBudget(qint64 bytes) { mBudget = bytes; }
+    void setMaxAge(int days) { mMaxAgeDays = days; }
+    qint64 totalSize() const;
+    bool insert(const QString& name, CacheIndex::Entry entry);
+    void touch(const QString& name);
+    void markChecked(const QString& name);
+    void pin(const QStringList& names, const QString& user);
+    void remove(const QString& name);
+    void clear();
+
+  private:
+    QDir mDir;
+    CacheIndex mIndex;
+    qint64 mBudget;
+    int mMaxAgeDays;
+    DiskQueue* mDiskQueue;
+
+    void evict(const QString& keepName);
+};
+
+#endif
@@ -0,0 +1,794 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "wallpaperDownload.moc"
+#include "atomicFile.h"
+#include "diskQueue.h"
+#include "jpegStreamDecoder.h"
+#include "mirrorScoreboard.h"
+
+namespace
+{
+  // A rate-limited body is let through in this many slices a second
+  const int PaceSlicesPerSec = 4;
+}
+
+/**
+ * Constructor
+ * @param manager The network access manager to issue the request with
+ * @param url Location of the wallpaper
+ * @param fileName Destination path; written only if the download succeeds
+ */
+WallpaperDownload::WallpaperDownload(QNetworkAccessManager* manager,
+                                     const QUrl& url, const QString& fileName,
+                                     QObject* parent)
+  : QObject(parent),
+    mManager(manager),
+    mReply(NULL),
+    mCandidates(),
+    mUrls(),
+    mNextUrl(0),
+    mPeerUrl(),
+    mPeerHedgeMsecs(0),
+    mMirrorHedgeMsecs(0),
+    mHedgeTimer(),
+    mScoreboard(NULL),
+    mClock(),
+    mPaceTimer(),
+    mRateLimit(0),
+    mBudget(0),
+    mFirstByteAt(0),
+    mAborted(false),
+    mFileName(fileName),
+    mPartFile(AtomicFile::tempFileName(fileName)),
+    mETag(),
+    mLastModified(),
+    mRequestETag(),
+    mRequestLastModified(),
+    mResume(false),
+    mResumable(false),
+    mBodyStarted(false),
+    mOffset(0),
+    mSize(0),
+    mHash(),
+    mContentHash(),
+    mExpectedHash(),
+    mCheckJpeg(false),
+    mHead(),
+    mTail(),
+    mDecoderThread(NULL),
+    mDecoder(NULL),
+    mImage(),
+    mDiskQueue(NULL),
+    mResult(Success),
+    mNetworkError(QNetworkReply::NoError),
+    mHttpStatus(0),
+    mErrorString()
+{
+  mUrls << url;
+  mHedgeTimer.setSingleShot(true);
+  connect(&mHedgeTimer, SIGNAL(timeout()), this, SLOT(hedge()));
+  mPaceTimer.setSingleShot(true);
+  mPaceTimer.setInterval(1000 / PaceSlicesPerSec);
+  connect(&mPaceTimer, SIGNAL(timeout()), this, SLOT(pace()));
+}
+
+/**
+ * Destructor
+ */
+WallpaperDownload::~WallpaperDownload()
+{
+  foreach (QNetworkReply* reply, mCandidates) {
+    reply->disconnect(this);
+    reply->abort();
+    delete reply;
+  }
+  // Aborting a reply finishes it at once, which mustn't reach us now
+  if (mReply) {
+    mReply->disconnect(this);
+    mReply->abort();
+    delete mReply;
+  }
+  stopDecoder();
+  if (mPartFile.isOpen()) {
+    mPartFile.close();
+    mPartFile.remove();
+  }
+}
+
+/**
+ * Makes the request conditional on the file having changed since it was
+ * downloaded with the given validators.  Must be called before start().
+ */
+void WallpaperDownload::setValidators(const QByteArray& eTag,
+                                      const QByteArray& lastModified)
+{
+  mResume = false;
+  mETag = eTag;
+  mLastModified = lastModified;
+}
+
+/**
+ * Continues an earlier, interrupted attempt whose temporary file is still on
+ * disk.  The validators are those the server sent with the partial body; if
+ * the file on the server has changed since, the server sends the whole thing
+ * and we start again from scratch.  Must be called before start().
+ */
+void WallpaperDownload::resumeFrom(const QByteArray& eTag,
+                                   const QByteArray& lastModified)
+{
+  mResume = true;
+  mETag = eTag;
+  mLastModified = lastModified;
+}
+
+/**
+ * Decodes the image on \a thread as it arrives, if this build is able to.
+ * Must be called before start().
+ */
+void WallpaperDownload::setDecoderThread(QThread* thread)
+{
+  if (JpegStreamDecoder::isAvailable()) {
+    mDecoderThread = thread;
+  }
+}
+
+/**
+ * Reads the body off the network no faster than \a bytesPerSec, or as fast
+ * as it comes if that is 0.  Must be called before start().
+ */
+void WallpaperDownload::setRateLimit(int bytesPerSec)
+{
+  mRateLimit = qMax(0, bytesPerSec);
+  mBudget = mRateLimit / PaceSlicesPerSec;
+}
+
+/**
+ * Offers the file from each of \a urls in turn, instead of just the one given
+ * to the constructor.  If the first byte from one hasn't arrived within
+ * \a hedgeDelayMsecs, the next is asked as well.  How each mirror fares is
+ * recorded in \a scoreboard, if given.  Must be called before start().
+ */
+void WallpaperDownload::setMirrors(const QList<QUrl>& urls,
+                                   int hedgeDelayMsecs,
+                                   MirrorScoreboard* scoreboard)
+{
+  if (!urls.isEmpty()) {
+    mUrls = urls;
+  }
+  mMirrorHedgeMsecs = hedgeDelayMsecs;
+  mScoreboard = scoreboard;
+}
+
+/**
+ * Asks the peer at \a url for the file before any of the mirrors, falling
+ * back on them if it fails or hasn't responded within \a hedgeDelayMsecs.
+ * The mirrors keep their own hedge delay.  Must be called before start().
+ */
+void WallpaperDownload::preferUrl(const QUrl& url, int hedgeDelayMsecs)
+{
+  mUrls.prepend(url);
+  mPeerUrl = url;
+  mPeerHedgeMsecs = hedgeDelayMsecs;
+}
+
+/**
+ * Opens the temporary file and issues the request.
+ * @returns false if the temporary file could not be created, in which case
+ *          finished() will not be emitted
+ */
+bool WallpaperDownload::start()
+{
+  startDecoder();
+  if (mResume && mPartFile.exists() && seedFromPartFile()) {
+    mOffset = mPartFile.size();
+  }
+
+  QIODevice::OpenMode mode = QIODevice::WriteOnly;
+  mode |= (mOffset > 0) ? QIODevice::Append : QIODevice::Truncate;
+  if (!mPartFile.open(mode) && mPartFile.exists() && mPartFile.remove()) {
+    // Left by another user of a shared cache, whose umask didn't let us
+    // write to it; start afresh in a file of our own
+    mOffset = 0;
+    resetContent();
+    mPartFile.open(QIODevice::WriteOnly | QIODevice::Truncate);
+  }
+  if (!mPartFile.isOpen()) {
+    mResult = FileFailure;
+    mErrorString = tr("Unable to write to file:\n") + mPartFile.fileName();
+    return false;
+  }
+  // In a directory that others may write to, they may want to resume from
+  // the file, so they get the same access to it as to the directory
+  QFile::Permissions dirPermissions =
+    QFileInfo(QFileInfo(mPartFile).path()).permissions();
+  QFile::Permissions shared = dirPermissions &
+    (QFile::ReadGroup | QFile::WriteGroup | QFile::ReadOther |
+     QFile::WriteOther);
+  if (shared & (QFile::WriteGroup | QFile::WriteOther)) {
+    mPartFile.setPermissions(mPartFile.permissions() | shared);
+  }
+  mSize = mOffset;
+  mRequestETag = mETag;
+  mRequestLastModified = mLastModified;
+
+  mClock.start();
+  launch();
+  return true;
+}
+
+/**
+ * Returns the request to make for \a url
+ */
+QNetworkRequest WallpaperDownload::request(const QUrl& url) const
+{
+  QNetworkRequest request(url);
+  if (mOffset > 0) {
+    request.setRawHeader("Range",
+                         "bytes=" + QByteArray::number(mOffset) + "-");
+    request.setRawHeader("If-Range",
+                         mETag.isEmpty() ? mLastModified : mETag);
+  } else if (!mResume) {
+    if (!mETag.isEmpty()) {
+      request.setRawHeader("If-None-Match", mETag);
+    }
+    if (!mLastModified.isEmpty()) {
+      request.setRawHeader("If-Modified-Since", mLastModified);
+    }
+  }
+  return request;
+}
+
+/**
+ * Asks the next mirror for the file, and sets the timer for asking the one
+ * after that
+ */
+void WallpaperDownload::launch()
+{
+  QUrl url = mUrls[mNextUrl++];
+  QNetworkReply* reply = mManager->get(request(url));
+  reply->setProperty("launchedAt", mClock.elapsed());
+  if (mRateLimit > 0) {
+    // Qt stops reading from the socket once this much is waiting for us
+    reply->setReadBufferSize(qMax(mRateLimit / PaceSlicesPerSec, 4096));
+  }
+  connect(reply, SIGNAL(metaDataChanged()), this, SLOT(replyMetaDataChanged()));
+  connect(reply, SIGNAL(readyRead()), this, SLOT(replyReadyRead()));
+  connect(reply, SIGNAL(finished()), this, SLOT(replyFinished()));
+  connect(reply, SIGNAL(downloadProgress(qint64, qint64)),
+          this, SLOT(replyDownloadProgress(qint64, qint64)));
+  mCandidates << reply;
+
+  if (mNextUrl < mUrls.size()) {
+    mHedgeTimer.start(url == mPeerUrl ? mPeerHedgeMsecs : mMirrorHedgeMsecs);
+  }
+}
+
+/**
+ * Called when the first byte hasn't arrived in good time; asks the next
+ * mirror as well
+ */
+void WallpaperDownload::hedge()
+{
+  if (!mReply && !mAborted && mNextUrl < mUrls.size()) {
+    launch();
+  }
+}
+
+/**
+ * Called once per slice of a rate-limited transfer; lets the next slice of
+ * the body through
+ */
+void WallpaperDownload::pace()
+{
+  mBudget += mRateLimit / PaceSlicesPerSec;
+  if (mReply) {
+    readBody();
+  }
+}
+
+/**
+ * Makes \a reply the one we use, if it is the first to bring a usable
+ * response, and cancels any others
+ * @returns true if \a reply is the one in use
+ */
+bool WallpaperDownload::claim(QNetworkReply* reply)
+{
+  if (mReply) {
+    return reply == mReply;
+  }
+  int status = statusCode(reply);
+  if (reply->error() != QNetworkReply::NoError ||
+      (status != 200 && status != 206 && status != 304)) {
+    return false;
+  }
+
+  mReply = reply;
+  mHedgeTimer.stop();
+  mCandidates.removeAll(reply);
+  foreach (QNetworkReply* other, mCandidates) {
+    other->disconnect(this);
+    other->abort();
+    other->deleteLater();
+  }
+  mCandidates.clear();
+
+  mFirstByteAt = mClock.elapsed();
+  if (mScoreboard && reply->url() != mPeerUrl) {
+    mScoreboard->recordFirstByte(reply->url(), mFirstByteAt -
+                                   reply->property("launchedAt").toInt());
+  }
+  return true;
+}
+
+/**
+ * Cancels the transfer; finished() will be emitted with a network failure
+ */
+void WallpaperDownload::abort()
+{
+  mAborted = true;
+  mHedgeTimer.stop();
+  mPaceTimer.stop();
+  foreach (QNetworkReply* reply, mCandidates) {
+    reply->abort();
+  }
+  if (mReply) {
+    mReply->abort();
+  }
+}
+
+/**
+ * Finishes without asking the server, because the file is already known to
+ * be current; finished() is emitted with the result NotModified.  For use
+ * instead of start().
+ */
+void WallpaperDownload::finishUnchanged()
+{
+  mResult = NotModified;
+  emit finished(this);
+}
+
+/**
+ * Stops the transfer at once, keeping what has arrived so far for a later
+ * attempt to resume from, if the server allows it (see hasPartialFile()).
+ * Unlike abort(), finished() is not emitted.
+ */
+void WallpaperDownload::suspend()
+{
+  mAborted = true;
+  mHedgeTimer.stop();
+  mPaceTimer.stop();
+  foreach (QNetworkReply* reply, mCandidates) {
+    reply->disconnect(this);
+    reply->abort();
+  }
+  if (mReply) {
+    mReply->disconnect(this);
+    mReply->abort();
+  }
+  mNetworkError = QNetworkReply::OperationCanceledError;
+  fail(NetworkFailure, tr("The download was interrupted."));
+}
+
+/**
+ * Called when a reply's headers arrive
+ */
+void WallpaperDownload::replyMetaDataChanged()
+{
+  claim(qobject_cast<QNetworkReply*>(sender()));
+}
+
+/**
+ * Called when more of a reply has arrived
+ */
+void WallpaperDownload::replyReadyRead()
+{
+  if (claim(qobject_cast<QNetworkReply*>(sender()))) {
+    readBody();
+  }
+}
+
+/**
+ * Moves whatever has arrived so far out of the reply and onto disk, so that
+ * only one network buffer's worth of the image is ever held in memory.
+ */
+void WallpaperDownload::readBody()
+{
+  // The body of anything other than a 200 or 206 (such as an error page) is of
+  // no interest to us
+  int status = statusCode(mReply);
+  if (!mPartFile.isOpen() || (status != 200 && status != 206)) {
+    return;
+  }
+  if (!mBodyStarted && !beginBody(status)) {
+    return;
+  }
+
+  // Once the reply has finished, everything left is already in memory
+  qint64 length = mReply->bytesAvailable();
+  if (mRateLimit > 0 && !mReply->isFinished()) {
+    length = qMin(length, qMax(mBudget, (qint64)0));
+    if (mBudget <= length && !mPaceTimer.isActive()) {
+      mPaceTimer.start();
+    }
+  }
+  if (length <= 0) {
+    return;
+  }
+  QByteArray chunk = mReply->read(length);
+  mBudget -= chunk.size();
+  addData(chunk);
+  mSize += chunk.size();
+  if (mPartFile.write(chunk) != chunk.size()) {
+    mResumable = false;
+    fail(FileFailure, tr("Unable to write to file:\n") + mPartFile.fileName());
+    mReply->abort();
+  }
+}
+
+/**
+ * Throws away whatever the peer sent, and asks the mirrors for the file from
+ * the start, under the conditions it was first asked for
+ * @returns false if there are no mirrors, or the file can't be started again
+ */
+bool WallpaperDownload::fallBackFromPeer()
+{
+  mUrls.removeAll(mPeerUrl);
+  mPeerUrl = QUrl();
+  if (mUrls.isEmpty()) {
+    return false;
+  }
+  mPartFile.close();
+  if (!mPartFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    return false;
+  }
+
+  mReply = NULL;
+  mNextUrl = 0;
+  mBodyStarted = false;
+  mResumable = false;
+  mOffset = 0;
+  mSize = 0;
+  mETag = mRequestETag;
+  mLastModified = mRequestLastModified;
+  mContentHash.clear();
+  mResult = Success;
+  mNetworkError = QNetworkReply::NoError;
+  mHttpStatus = 0;
+  mErrorString.clear();
+  resetContent();
+  launch();
+  return true;
+}
+
+/**
+ * Called when a reply has completed.  If it is the one in use, commits the
+ * file if all went well; if it failed before bringing anything useful, moves
+ * on to the next mirror.
+ */
+void WallpaperDownload::replyFinished()
+{
+  QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+  bool claimed = claim(reply);
+  if (!claimed) {
+    mCandidates.removeAll(reply);
+    if (mScoreboard && !mAborted && reply->url() != mPeerUrl) {
+      mScoreboard->recordFailure(reply->url());
+    }
+    if (!mAborted && mCandidates.isEmpty() && mNextUrl < mUrls.size()) {
+      reply->deleteLater();
+      launch();
+      return;
+    }
+    if (!mCandidates.isEmpty()) {
+      reply->deleteLater();
+      return;
+    }
+    // Every mirror has failed; report the last failure
+    mReply = reply;
+  }
+  mHedgeTimer.stop();
+  mPaceTimer.stop();
+  mReply->deleteLater();
+
+  int status = statusCode(mReply);
+  mHttpStatus = status;
+  if (mResult == Success && mReply->error() != QNetworkReply::NoError) {
+    mNetworkError = mReply->error();
+    fail(NetworkFailure, mReply->errorString());
+  } else if (mResult == Success && status != 200 && status != 206 &&
+             status != 304) {
+    mNetworkError = QNetworkReply::ProtocolFailure;
+    fail(NetworkFailure, tr("The server sent an unexpected response (%1).").
+                           arg(status));
+  }
+
+  if (mResult == Success && status == 304) {
+    mResult = NotModified;
+    mPartFile.close();
+    mPartFile.remove();
+  }
+
+  if (mResult == Success) {
+    // Pick up anything that arrived after the last readyRead()
+    readBody();
+    mContentHash = mHash.result().toHex();
+    if (mScoreboard && mReply->url() != mPeerUrl &&
+        mSize - mOffset >= 64 * 1024) {
+      mScoreboard->recordTransfer(mReply->url(), mSize - mOffset,
+                                  mClock.elapsed() - mFirstByteAt);
+    }
+    verify();
+  }
+
+  if (claimed && mReply->url() == mPeerUrl && !mAborted &&
+      (mResult == NetworkFailure || mResult == VerificationFailure) &&
+      fallBackFromPeer()) {
+    return;
+  }
+  mReply = NULL;
+
+  // Committing the file to disk can be slow, so it's left to the disk queue
+  // if there is one
+  if (mResult == Success && mDiskQueue) {
+    mPartFile.close();
+    connect(mDiskQueue, SIGNAL(fileCommitted(QString, bool)),
+            this, SLOT(fileCommitted(QString, bool)));
+    mDiskQueue->commitFile(mPartFile.fileName(), mFileName);
+    return;
+  }
+  if (mResult == Success) {
+    bool synced = AtomicFile::sync(mPartFile);
+    mPartFile.close();
+    if (!synced || !AtomicFile::replace(mPartFile.fileName(), mFileName)) {
+      fail(FileFailure, tr("Unable to write to file:\n") + mFileName);
+    }
+  }
+  finishDecoding();
+}
+
+/**
+ * Called when the disk queue has committed a file
+ */
+void WallpaperDownload::fileCommitted(const QString& fileName, bool succeeded)
+{
+  if (fileName != mFileName) {
+    return;
+  }
+  disconnect(mDiskQueue, 0, this, 0);
+  if (!succeeded) {
+    fail(FileFailure, tr("Unable to write to file:\n") + mFileName);
+  }
+  finishDecoding();
+}
+
+/**
+ * Waits for the decoder, if any, to catch up with the last of the data, and
+ * then reports that the download has finished
+ */
+void WallpaperDownload::finishDecoding()
+{
+  if (mResult == Success && mDecoder) {
+    QMetaObject::invokeMethod(mDecoder, "finish", Qt::QueuedConnection);
+    return;
+  }
+  stopDecoder();
+  emit finished(this);
+}
+
+/**
+ * Called when the decoder has finished with the image
+ */
+void WallpaperDownload::imageDecoded(const QImage& image)
+{
+  mImage = image;
+  stopDecoder();
+  emit finished(this);
+}
+
+/**
+ * Reports progress over the whole file, including any part we already had
+ */
+void WallpaperDownload::replyDownloadProgress(qint64 bytesReceived,
+                                              qint64 bytesTotal)
+{
+  if (sender() != mReply) {
+    return;
+  }
+  if (bytesTotal >= 0) {
+    bytesTotal += mOffset;
+  }
+  emit downloadProgress(bytesReceived + mOffset, bytesTotal);
+}
+
+/**
+ * Returns the HTTP status code of \a reply, or 0 if none has arrived yet
+ */
+int WallpaperDownload::statusCode(QNetworkReply* reply)
+{
+  return reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+}
+
+/**
+ * Feeds the bytes already in the temporary file into the hash and the
+ * decoder, so that a resumed download still covers the whole file
+ * @returns false if the file could not be read
+ */
+bool WallpaperDownload::seedFromPartFile()
+{
+  QFile file(mPartFile.fileName());
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+  while (!file.atEnd()) {
+    QByteArray chunk = file.read(64 * 1024);
+    if (chunk.isEmpty()) {
+      resetContent();
+      return false;
+    }
+    addData(chunk);
+  }
+  return true;
+}
+
+/**
+ * Sets up a fresh decoder on the decoder thread, if we have one, discarding
+ * anything given to the old one
+ */
+void WallpaperDownload::startDecoder()
+{
+  stopDecoder();
+  if (!mDecoderThread) {
+    return;
+  }
+  mDecoder = new JpegStreamDecoder();
+  mDecoder->moveToThread(mDecoderThread);
+  connect(mDecoder, SIGNAL(decoded(QImage)), this, SLOT(imageDecoded(QImage)));
+}
+
+/**
+ * Disposes of the decoder, once it has dealt with anything already queued
+ */
+void WallpaperDownload::stopDecoder()
+{
+  if (mDecoder) {
+    disconnect(mDecoder, 0, this, 0);
+    mDecoder->deleteLater();
+    mDecoder = NULL;
+  }
+}
+
+/**
+ * Forgets everything seen of the body so far, to start again from scratch
+ */
+void WallpaperDownload::resetContent()
+{
+  mHash.reset();
+  mHead.clear();
+  mTail.clear();
+  startDecoder();
+}
+
+/**
+ * Passes the next chunk of the body to the hash and the decoder, and keeps
+ * the ends of the body for verify()
+ */
+void WallpaperDownload::addData(const QByteArray& chunk)
+{
+  mHash.addData(chunk);
+  if (mHead.size() < 2) {
+    mHead.append(chunk.left(2 - mHead.size()));
+  }
+  mTail = (mTail + chunk).right(32);
+  if (mDecoder) {
+    QMetaObject::invokeMethod(mDecoder, "addData", Qt::QueuedConnection,
+                              Q_ARG(QByteArray, chunk));
+  }
+}
+
+/**
+ * Called when the first bytes of the body arrive, once the headers are known.
+ * Checks that a partial response continues exactly where our file leaves off,
+ * and starts again from scratch if the server sent the whole file instead.
+ * @returns false if the response can't be used
+ */
+bool WallpaperDownload::beginBody(int status)
+{
+  mBodyStarted = true;
+
+  if (status == 206) {
+    // Content-Range: bytes <first>-<last>/<total>
+    QByteArray range = mReply->rawHeader("Content-Range");
+    qint64 first = range.mid(6).split('-').value(0).toLongLong();
+    if (!range.startsWith("bytes ") || first != mOffset) {
+      mResumable = false;
+      mNetworkError = QNetworkReply::ProtocolFailure;
+      fail(NetworkFailure, tr("The server sent an unexpected part of the "
+                              "file."));
+      mReply->abort();
+      return false;
+    }
+  } else if (mOffset > 0) {
+    // The server ignored our Range header, or the file has changed since
+    mPartFile.resize(0);
+    resetContent();
+    mSize = 0;
+    mOffset = 0;
+  }
+
+  QByteArray eTag = mReply->rawHeader("ETag");
+  QByteArray lastModified = mReply->rawHeader("Last-Modified");
+  if (status == 200 || !eTag.isEmpty() || !lastModified.isEmpty()) {
+    mETag = eTag;
+    mLastModified = lastModified;
+  }
+  mResumable = !(mETag.isEmpty() && mLastModified.isEmpty()) &&
+               mReply->rawHeader("Accept-Ranges") != "none";
+  return true;
+}
+
+/**
+ * Checks the complete body against the expected hash, if we have one, and
+ * otherwise that it at least starts and ends like a JPEG.  Some encoders pad
+ * the file after the end marker, so a little leeway is allowed there.
+ */
+void WallpaperDownload::verify()
+{
+  bool ok = true;
+  if (!mExpectedHash.isEmpty()) {
+    ok = (mContentHash == mExpectedHash.toLower());
+  } else if (mCheckJpeg) {
+    ok = (mHead == "\xff\xd8" && mTail.contains("\xff\xd9"));
+  }
+  if (!ok) {
+    mResumable = false;
+    fail(VerificationFailure, tr("The downloaded file is damaged."));
+  }
+}
+
+/**
+ * Records a failure.  The partial file is thrown away unless it is worth
+ * resuming later.
+ */
+void WallpaperDownload::fail(Result result, const QString& errorString)
+{
+  if (mResult != Success) {
+    return;
+  }
+  mResult = result;
+  mErrorString = errorString;
+  if (mPartFile.isOpen()) {
+    if (hasPartialFile()) {
+      AtomicFile::sync(mPartFile);
+    }
+    mPartFile.close();
+  }
+  if (!hasPartialFile()) {
+    mPartFile.remove();
+  }
+}
@@ -0,0 +1,186 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WALLPAPERDOWNLOAD_H
+#define WALLPAPERDOWNLOAD_H
+
+#include <QtNetwork>
+#include <QtGui>
+#include "sha256.h"
+
+class JpegStreamDecoder;
+class MirrorScoreboard;
+class DiskQueue;
+
+
+/**
+ * A single wallpaper transfer.  The body of the reply is streamed into a
+ * temporary file next to the destination as it arrives, and the file is only
+ * moved into place once the transfer has completed successfully, so an
+ * interrupted download never replaces a good file.
+ *
+ * If validators from a previous download are given, the request is made
+ * conditional, and a "304 Not Modified" response leaves the existing file
+ * alone.
+ *
+ * If the transfer is interrupted and the server supplied a validator, the
+ * temporary file is kept so that a later attempt can pick up where this one
+ * left off using a Range request (see resumeFrom()).
+ *
+ * The body is hashed with SHA-256 as it streams in.  If an expected hash is
+ * given, or the body is expected to be a JPEG, a body that fails the check is
+ * thrown away just as an interrupted one would be.
+ *
+ * The file may be offered by several mirrors.  The first is asked first, and
+ * if it hasn't started to respond within the hedge delay, or fails, the next
+ * is asked too; whichever responds first is used and the other is cancelled.
+ * A peer on the local network may be asked before the mirrors (see
+ * preferUrl()); if it lets us down, even partway through, the mirrors are
+ * asked from the start, and the peer's failure counts against nobody.
+ *
+ * If given a decoder thread, the image is also decoded there as it arrives,
+ * and finished() waits for the last of it to be decoded (see image()).
+ *
+ * A transfer that can take its time may be given a rate limit, in which case
+ * the body is read off the network no faster than that.  Qt then leaves the
+ * rest in the socket, and TCP slows the sender down to match.
+ */
+class WallpaperDownload : public QObject
+{
+  Q_OBJECT
+
+  public:
+    WallpaperDownload(QNetworkAccessManager* manager, const QUrl& url,
+                      const QString& fileName, QObject* parent = 0);
+    ~WallpaperDownload();
+    enum Result { Success, NotModified, NetworkFailure, FileFailure,
+                  VerificationFailure };
+    void setValidators(const QByteArray& eTag, const QByteArray& lastModified);
+    void resumeFrom(const QByteArray& eTag, const QByteArray& lastModified);
+    void setExpectedHash(const QByteArray& hash) { mExpectedHash = hash; }
+    void setCheckJpeg(bool check) { mCheckJpeg = check; }
+    void setDecoderThread(QThread* thread);
+    void setDiskQueue(DiskQueue* queue) { mDiskQueue = queue; }
+    void setRateLimit(int bytesPerSec);
+    void setMirrors(const QList<QUrl>& urls, int hedgeDelayMsecs,
+                    MirrorScoreboard* scoreboard);
+    void preferUrl(const QUrl& url, int hedgeDelayMsecs);
+    bool start();
+    void finishUnchanged();
+    QString fileName() const { return mFileName; }
+    QByteArray eTag() const { return mETag; }
+    QByteArray lastModified() const { return mLastModified; }
+    qint64 size() const { return mSize; }
+    QByteArray contentHash() const { return mContentHash; }
+    QImage image() const { return mImage; }
+    bool hasPartialFile() const { return mResult == NetworkFailure &&
+                                         mResumable; }
+    Result result() const { return mResult; }
+    QNetworkReply::NetworkError networkError() const { return mNetworkError; }
+    int httpStatus() const { return mHttpStatus; }
+    QString errorString() const { return mErrorString; }
+
+  signals:
+    void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void finished(WallpaperDownload* download);
+
+  public slots:
+    void abort();
+    void suspend();
+
+  private slots:
+    void replyMetaDataChanged();
+    void replyReadyRead();
+    void replyFinished();
+    void replyDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void hedge();
+    void pace();
+    void imageDecoded(const QImage& image);
+    void fileCommitted(const QString& fileName, bool succeeded);
+
+  private:
+    QNetworkAccessManager* mManager;
+    QPointer<QNetworkReply> mReply;
+    QList<QNetworkReply*> mCandidates;
+    QList<QUrl> mUrls;
+    int mNextUrl;
+    QUrl mPeerUrl;
+    int mPeerHedgeMsecs;
+    int mMirrorHedgeMsecs;
+    QTimer mHedgeTimer;
+    MirrorScoreboard* mScoreboard;
+    QTime mClock;
+    QTimer mPaceTimer;
+    int mRateLimit;
+    qint64 mBudget;
+    int mFirstByteAt;
+    bool mAborted;
+    const QString mFileName;
+    QFile mPartFile;
+    QByteArray mETag;
+    QByteArray mLastModified;
+    QByteArray mRequestETag;
+    QByteArray mRequestLastModified;
+    bool mResume;
+    bool mResumable;
+    bool mBodyStarted;
+    qint64 mOffset;
+    qint64 mSize;
+    Sha256 mHash;
+    QByteArray mContentHash;
+    QByteArray mExpectedHash;
+    bool mCheckJpeg;
+    QByteArray mHead;
+    QByteArray mTail;
+    QThread* mDecoderThread;
+    JpegStreamDecoder* mDecoder;
+    QImage mImage;
+    DiskQueue* mDiskQueue;
+    Result mResult;
+    QNetworkReply::NetworkError mNetworkError;
+    int mHttpStatus;
+    QString mErrorString;
+
+    static int statusCode(QNetworkReply* reply);
+    QNetworkRequest request(const QUrl& url) const;
+    void launch();
+    bool claim(QNetworkReply* reply);
+    void readBody();
+    bool fallBackFromPeer();
+    void finishDecoding();
+    bool seedFromPartFile();
+    void startDecoder();
+    void stopDecoder();
+    void resetContent();
+    void addData(const QByteArray& chunk);
+    void verify();
+    bool beginBody(int status);
+    void fail(Result result, const QString& errorString);
+};
+
+#endif
@@ -29,10 +29,110 @@
 #include <QtGui>
 #include "wallpaperGetter.moc"
 #include "application.h"
+#include "wallpaperDownload.h"
+#include "jpegStreamDecoder.h"
+#include "wallpaperSetter.h"
+#include "peerCache.h"
+#include "lockFile.h"
+#include "variantSelector.h"
+#include "atomicFile.h"
+#include "memoryUsage.h"
+#include "diskQueue.h"
 
-#ifdef Q_WS_WIN
-#include <windows.h>
-#endif
+namespace
+{
+  const char* const WallpaperUrl = "http://www.omships.org/images/desktops/";
+
+  // How many times to download a wallpaper that arrives damaged
+  const int MaxAttempts = 3;
+
+  // How long to wait before asking again for a checksum manifest that the
+  // server may not have
+  const uint ManifestRetrySecs = 60 * 60;
+
+  // How long to give a peer to start sending a wallpaper before asking the
+  // mirrors as well
+  const int PeerHedgeMsecs = 1000;
+
+  // How often the locks we hold in a shared cache are refreshed, so that
+  // other processes don't take them for abandoned
+  const int LockRefreshMsecs = 60 * 1000;
+
+  /**
+   * Returns the key under which the retry queue keeps track of requests for
+   * the file \a name.  Prefetches back off on their own, so that a wallpaper
+   * not yet published days before its month doesn't hold up the request made
+   * when the month begins.
+   */
+  QString retryKey(const QString& name, bool prefetch)
+  {
+    return prefetch ? "prefetch/" + name : name;
+  }
+
+  /**
+   * Returns the name of the user we're running for, under which the files on
+   * their desktop are pinned in the cache
+   */
+  QString userName()
+  {
+    QString name = QString::fromLocal8Bit(qgetenv(WINDOWS ? "USERNAME" :
+                                                            "USER"));
+    return name.isEmpty() ? QString("-") : name;
+  }
+
+  /**
+   * Returns the base URLs of the mirrors to fetch wallpapers from, which may
+   * be set with "network/mirrors"
+   */
+  QStringList configuredMirrors()
+  {
+    QSettings settings;
+    QStringList mirrors;
+    foreach (QString mirror,
+             settings.value("network/mirrors",
+                            QStringList() << WallpaperUrl).toStringList()) {
+      mirrors << (mirror.endsWith('/') ? mirror : mirror + '/');
+    }
+    if (mirrors.isEmpty()) {
+      mirrors << WallpaperUrl;
+    }
+    return mirrors;
+  }
+
+  /**
+   * Returns the directory to keep wallpapers in: the machine-wide one named
+   * by "cache/sharedPath" (usually set in the system-wide settings), if it
+   * is usable, or else the user's own
+   */
+  QString cacheDirectory()
+  {
+    QSettings settings;
+    QString shared = settings.value("cache/sharedPath").toString();
+    if (!shared.isEmpty()) {
+      if (QDir().mkpath(shared) && QFileInfo(shared).isWritable()) {
+        return QDir(shared).path();
+      }
+      qWarning() << "Unable to use the shared cache directory" << shared;
+    }
+    return QDesktopServices::storageLocation(QDesktopServices::DataLocation);
+  }
+
+  /**
+   * Returns the geometry of each screen, for telling whether the files last
+   * set still fit them
+   */
+  QStringList screenLayout()
+  {
+    QStringList layout;
+    QDesktopWidget* desktop = QApplication::desktop();
+    for (int screen = 0; screen < desktop->numScreens(); screen++) {
+      QRect geometry = desktop->screenGeometry(screen);
+      layout << QString("%1x%2+%3+%4").arg(geometry.width()).
+                  arg(geometry.height()).arg(geometry.x()).arg(geometry.y());
+    }
+    return layout;
+  }
+}
 
 
 /**
@@ -40,21 +140,97 @@
  */
 WallpaperGetter::WallpaperGetter(QObject* parent)
   : QObject(parent),
-    mManager(new QNetworkAccessManager()),
-    mProgressWidget(new ProgressWidget()),
-    mWallpaperDir(QDesktopServices::storageLocation(
-                    QDesktopServices::DataLocation))
+    mManager(NULL),
+    mProgressWidget(),
+    mWallpaperDir(cacheDirectory()),
+    mCache(mWallpaperDir.path()),
+    mQueuedDownloads(),
+    mActiveDownloads(),
+    mMaxConnections(2),
+    mProgress(),
+    mPendingApply(false),
+    mPendingReport(false),
+    mPrefetchFailed(false),
+    mPrefetchNotYetAvailable(false),
+    mPipeline(new ImagePipeline(this)),
+    mDecoderThread(NULL),
+    mDecodeWhileDownloading(false),
+    mDecodedImages(),
+    mSetter(WallpaperSetter::detect(this)),
+    mMirrors(configuredMirrors()),
+    mRetries(),
+    mManifest(),
+    mManifestRequested(0),
+    mPeers(NULL),
+    mShared(false),
+    mLockPollTimer(new QTimer(this)),
+    mLockRefreshTimer(new QTimer(this)),
+    mDownloadLocks(),
+    mPipelineLocks(),
+    mWaitingSources(),
+    mIdleTimer(new QTimer(this)),
+    mDiskThread(new QThread(this)),
+    mDiskQueue(new DiskQueue()),
+    mApplyingFiles(),
+    mApplyingSources()
 {
-  QRect screen = QApplication::desktop()->screenGeometry();
-  QPoint topLeft = screen.center() -
-                     QPoint(mProgressWidget->width() / 2,
-                            mProgressWidget->height() / 2);
-  mProgressWidget->move(topLeft);
+  connect(mPipeline, SIGNAL(finished(ImagePipeline::TaskList)),
+          this, SLOT(imagesReady(ImagePipeline::TaskList)));
+  if (mSetter) {
+    connect(mSetter, SIGNAL(finished(bool, QString)),
+            this, SLOT(setterFinished(bool, QString)));
+  }
+
+  // In a cache shared by every user of the machine, one process fetches or
+  // converts each file while any others wanting it wait
+  mShared = (mWallpaperDir != QDir(QDesktopServices::storageLocation(
+                                     QDesktopServices::DataLocation)));
+  mCache.setShared(mShared);
+
+  // The cache may be on slow storage, so as far as possible it is written in
+  // the background, starting with creating the directory
+  mDiskQueue->moveToThread(mDiskThread);
+  mDiskThread->start();
+  mCache.setDiskQueue(mDiskQueue);
+  mDiskQueue->makePath(mWallpaperDir.path());
+  mLockPollTimer->setInterval(1000);
+  connect(mLockPollTimer, SIGNAL(timeout()), this, SLOT(pollLocks()));
+  mLockRefreshTimer->setInterval(LockRefreshMsecs);
+  connect(mLockRefreshTimer, SIGNAL(timeout()), this, SLOT(refreshLocks()));
+
+  QSettings settings;
+  mCache.setBudget(
+    settings.value("cache/budgetMegabytes", 50).toLongLong() * 1024 * 1024);
+  mCache.setMaxAge(settings.value("cache/maxAgeDays", 366).toInt());
+  mMaxConnections =
+    qMax(1, settings.value("network/maxConnections", 2).toInt());
+  mManifest.load(mCache.filePath(ChecksumManifest::FileName));
 
-  connect(mManager.data(), SIGNAL(finished(QNetworkReply*)),
-          this, SLOT(loadingFinished(QNetworkReply*)));
-  connect(mManager.data(), SIGNAL(finished(QNetworkReply*)),
-          mProgressWidget.data(), SLOT(hide()));
+  if (PeerCache::isEnabled()) {
+    mPeers = new PeerCache(&mCache, this);
+    if (mPeers->start()) {
+      connect(mPeers, SIGNAL(lookupFinished(QString, QUrl)),
+              this, SLOT(peerLookupFinished(QString, QUrl)));
+    } else {
+      delete mPeers;
+      mPeers = NULL;
+    }
+  }
+
+  // Decoding a wallpaper is only worth overlapping with its download if
+  // something is going to be done with the image
+  bool fitToScreen = settings.value("wallpaper/fitToScreen", true).toBool();
+  mDecodeWhileDownloading =
+    JpegStreamDecoder::isAvailable() && (fitToScreen || WINDOWS);
+
+  // The network, progress window and decoder are needed only a few times a
+  // month, so they are created when wanted and let go once things go quiet
+  int idleMinutes = settings.value("memory/idleMinutes", 5).toInt();
+  mIdleTimer->setSingleShot(true);
+  mIdleTimer->setInterval(qMax(1, idleMinutes) * 60 * 1000);
+  if (idleMinutes > 0) {
+    connect(mIdleTimer, SIGNAL(timeout()), this, SLOT(releaseIdleResources()));
+  }
 }
 
 /**
@@ -62,6 +238,126 @@ WallpaperGetter::WallpaperGetter(QObject* parent)
  */
 WallpaperGetter::~WallpaperGetter()
 {
+  // Nothing more may be started, and downloads going now must not report
+  // back to us as they are aborted
+  mLockPollTimer->stop();
+  mLockRefreshTimer->stop();
+  mQueuedDownloads.clear();
+  mActiveDownloads.clear();
+  QList<WallpaperDownload*> downloads = findChildren<WallpaperDownload*>();
+  foreach (WallpaperDownload* download, downloads) {
+    disconnect(download, 0, this, 0);
+  }
+  // Downloads must go before the network manager that their replies use
+  qDeleteAll(downloads);
+
+  // Only once nothing is writing the files they guard
+  qDeleteAll(mDownloadLocks);
+  mDownloadLocks.clear();
+  qDeleteAll(mPipelineLocks);
+  mPipelineLocks.clear();
+
+  // Let everything asked of the disk queue be done before it goes
+  mDiskQueue->waitForIdle();
+  mDiskThread->quit();
+  mDiskThread->wait();
+  delete mDiskQueue;
+  if (mDecoderThread) {
+    mDecoderThread->quit();
+    mDecoderThread->wait();
+  }
+}
+
+/**
+ * Returns the network access manager, creating it if need be
+ */
+QNetworkAccessManager* WallpaperGetter::networkManager()
+{
+  if (!mManager) {
+    mManager = new QNetworkAccessManager(this);
+  }
+  return mManager;
+}
+
+/**
+ * Returns the progress widget, creating it in the middle of the screen if
+ * need be
+ */
+ProgressWidget* WallpaperGetter::progressWidget()
+{
+  if (!mProgressWidget) {
+    mProgressWidget = QSharedPointer<ProgressWidget>(new ProgressWidget());
+    connect(mProgressWidget.data(), SIGNAL(cancelled()),
+            this, SLOT(cancelRefresh()));
+    QRect screen = QApplication::desktop()->screenGeometry();
+    QPoint topLeft = screen.center() -
+                       QPoint(mProgressWidget->width() / 2,
+                              mProgressWidget->height() / 2);
+    mProgressWidget->move(topLeft);
+  }
+  return mProgressWidget.data();
+}
+
+/**
+ * Returns the thread to decode wallpapers on while they download, starting
+ * it if need be, or NULL if they are not to be decoded that way
+ */
+QThread* WallpaperGetter::decoderThread()
+{
+  if (mDecodeWhileDownloading && !mDecoderThread) {
+    mDecoderThread = new QThread(this);
+    mDecoderThread->start(QThread::LowPriority);
+  }
+  return mDecoderThread;
+}
+
+/**
+ * Returns true while anything is under way that uses the network, the
+ * progress widget or the decoder
+ */
+bool WallpaperGetter::isBusy() const
+{
+  return !mQueuedDownloads.isEmpty() || !mActiveDownloads.isEmpty() ||
+         !mWaitingSources.isEmpty() || !mPipelineLocks.isEmpty() ||
+         (mProgressWidget && mProgressWidget->isVisible());
+}
+
+/**
+ * Lets go of everything that is only needed while fetching or setting a
+ * wallpaper, so that between times the process holds little more than its
+ * tray icon.  If something is still under way, we look again later.
+ */
+void WallpaperGetter::releaseIdleResources()
+{
+  if (isBusy()) {
+    mIdleTimer->start();
+    return;
+  }
+
+  QString before = MemoryUsage::report();
+
+  // Any finished downloads are deleted before the manager their replies
+  // came from
+  if (mManager) {
+    mManager->deleteLater();
+    mManager = NULL;
+  }
+  mProgressWidget.clear();
+  if (mDecoderThread) {
+    mDecoderThread->quit();
+    mDecoderThread->wait();
+    delete mDecoderThread;
+    mDecoderThread = NULL;
+  }
+  mDecodedImages.clear();
+  QPixmapCache::clear();
+
+  // Let the deletions above happen before measuring
+  QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+  MemoryUsage::trim();
+  qDebug() << "Released idle resources; memory use was" << before <<
+              "and is now" << MemoryUsage::report();
+  qDebug() << "Disk operation times:" << qPrintable(mDiskQueue->report());
 }
 
 /**
@@ -69,64 +365,686 @@ WallpaperGetter::~WallpaperGetter()
  */
 void WallpaperGetter::clearCache()
 {
-  // (This list will just be empty if the directory doesn't exist)
-  QStringList entries = mWallpaperDir.entryList(QDir::Files);
-  foreach (QString entry, entries) {
-    mWallpaperDir.remove(entry);
+  // Nothing may be left writing to the cache while it is cleared.  A
+  // download may already have handed its file to the disk queue, which will
+  // commit it before clearing the directory, so whatever it reports later
+  // must not be recorded.
+  foreach (WallpaperDownload* download, mActiveDownloads) {
+    download->setProperty("cleared", true);
+  }
+  cancelDownloads(mQueuedDownloads + mActiveDownloads);
+  mCache.clear();
+}
+
+/**
+ * Stops the downloads whose progress is being shown, and hides the progress
+ * widget
+ */
+void WallpaperGetter::cancelRefresh()
+{
+  QList<WallpaperDownload*> downloads = mProgress.keys();
+  mProgress.clear();
+  mPendingApply = false;
+  mPendingReport = false;
+  cancelDownloads(downloads);
+  if (mProgressWidget) {
+    mProgressWidget->hide();
   }
 }
 
 /**
- * Starts downloading this month's wallpaper
+ * Stops the given downloads.  Those not yet talking to the server are
+ * simply dropped; the rest are aborted, and finish as cancelled.
+ */
+void WallpaperGetter::cancelDownloads(
+  const QList<WallpaperDownload*>& downloads)
+{
+  bool droppedPrefetch = false;
+  foreach (WallpaperDownload* download, downloads) {
+    if (mQueuedDownloads.removeAll(download) > 0 ||
+        download->property("awaitingPeers").toBool() ||
+        download->property("awaitingLock").toBool()) {
+      mActiveDownloads.removeAll(download);
+      mProgress.remove(download);
+      delete mDownloadLocks.take(download);
+      mRetries.release(download->property("retryKey").toString());
+      droppedPrefetch |= download->property("prefetch").toBool();
+      download->deleteLater();
+    } else if (mActiveDownloads.contains(download)) {
+      download->abort();
+    }
+  }
+
+  if (droppedPrefetch && !hasPendingDownloads(true)) {
+    emit prefetchFinished(false, false);
+  }
+  pumpQueue();
+}
+
+/**
+ * Returns how long the server's word that a cached file is current is good for
+ */
+uint WallpaperGetter::revalidateSecs() const
+{
+  QSettings settings;
+  return settings.value("cache/revalidateHours", 24).toUInt() * 60 * 60;
+}
+
+/**
+ * Returns true if it is time to ask the server whether the cached file
+ * described by \a entry is still current.  A wallpaper prefetched ahead of
+ * its month would otherwise be due the moment the month began, on every
+ * machine at once, so it is trusted for a while into the month; how long is
+ * peculiar to the machine and user, and up to the usual revalidation period.
+ */
+bool WallpaperGetter::needsRevalidating(const CacheIndex::Entry& entry) const
+{
+  if (!entry.isValid()) {
+    return true;
+  }
+  uint now = QDateTime::currentDateTime().toTime_t();
+  uint period = qMax(revalidateSecs(), 1u);
+  if (entry.month >= 1 && entry.month <= 12) {
+    uint monthStart =
+      QDateTime(QDate(entry.year, entry.month, 1)).toTime_t();
+    if (entry.checked < monthStart && now >= monthStart) {
+      uint trustSecs =
+        qHash(QHostInfo::localHostName() + '/' + userName()) % period;
+      return now - monthStart >= trustSecs;
+    }
+  }
+  return now - entry.checked >= period;
+}
+
+/**
+ * Returns the resolution of wallpaper that best suits each screen, indexed by
+ * screen number
+ */
+QStringList WallpaperGetter::screenResolutions() const
+{
+  QSettings settings;
+  VariantSelector selector(
+    settings.value("wallpaper/variants",
+                   VariantSelector::defaultVariants()).toStringList());
+
+  QStringList resolutions;
+  QDesktopWidget* desktop = qobject_cast<Application*>(qApp)->desktop();
+  for (int screen = 0; screen < desktop->numScreens(); screen++) {
+    resolutions << selector.bestFor(desktop->screenGeometry(screen).size());
+  }
+  return resolutions;
+}
+
+/**
+ * Returns the cached files to use for the given month, indexed by screen
+ * number.  A screen whose preferred resolution isn't cached falls back to the
+ * primary screen's, and then to any that is.  The list is empty if nothing for
+ * the month is cached.
+ */
+QStringList WallpaperGetter::wallpaperFiles(int month, int year) const
+{
+  QStringList resolutions = screenResolutions();
+  int primaryScreen =
+    qobject_cast<Application*>(qApp)->desktop()->primaryScreen();
+
+  QStringList fallbacks;
+  fallbacks << resolutions.value(primaryScreen) << resolutions;
+  QString fallback;
+  foreach (QString resolution, fallbacks) {
+    QString path =
+      mCache.filePath(WallpaperCache::fileName(month, year, resolution));
+    if (QFile::exists(path)) {
+      fallback = path;
+      break;
+    }
+  }
+  if (fallback.isEmpty()) {
+    return QStringList();
+  }
+
+  QStringList files;
+  foreach (QString resolution, resolutions) {
+    QString path =
+      mCache.filePath(WallpaperCache::fileName(month, year, resolution));
+    files << (QFile::exists(path) ? path : fallback);
+  }
+  return files;
+}
+
+/**
+ * Returns true if the wallpaper for the given month is already in the cache
+ * for every screen
+ */
+bool WallpaperGetter::isCached(int month, int year) const
+{
+  foreach (QString resolution, screenResolutions()) {
+    QString filename = WallpaperCache::fileName(month, year, resolution);
+    if (!QFile::exists(mCache.filePath(filename))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Hands the desktop the files it was last given, if they are for this month
+ * and the screens haven't changed since, without touching the network or
+ * the image pipeline.  This is meant for startup, while the session is
+ * still busy logging in; refreshWallpaper() can check for news later.
+ * @returns true if the wallpaper is being set
+ */
+bool WallpaperGetter::applyCachedWallpaper()
+{
+  if (!canSetWallpaper()) {
+    return false;
+  }
+
+  QSettings settings;
+  QDate today = QDate::currentDate();
+  QStringList files = settings.value("state/wallpaperFiles").toStringList();
+  if (files.isEmpty() ||
+      settings.value("state/month").toInt() != today.month() ||
+      settings.value("state/year").toInt() != today.year() ||
+      settings.value("state/screens").toStringList() != screenLayout()) {
+    return false;
+  }
+  foreach (QString file, files) {
+    if (!QFile::exists(file)) {
+      return false;
+    }
+  }
+
+  mApplyingSources = settings.value("state/sourceFiles").toStringList();
+  applyToDesktop(files);
+  return true;
+}
+
+/**
+ * Returns true if the desktop has been given, or is being given, what was
+ * made from \a sourceFileNames for this month and these screens
+ */
+bool WallpaperGetter::isShowing(const QStringList& sourceFileNames) const
+{
+  if (!mApplyingFiles.isEmpty()) {
+    return sourceFileNames == mApplyingSources;
+  }
+  QSettings settings;
+  QDate today = QDate::currentDate();
+  return settings.value("state/sourceFiles").toStringList() ==
+           sourceFileNames &&
+         settings.value("state/month").toInt() == today.month() &&
+         settings.value("state/year").toInt() == today.year() &&
+         settings.value("state/screens").toStringList() == screenLayout();
+}
+
+/**
+ * Returns when this month's wallpaper may next be asked for, if an earlier
+ * attempt failed, or a null time if nothing is holding it back
+ */
+QDateTime WallpaperGetter::nextRefreshAttempt() const
+{
+  QDate today = QDate::currentDate();
+  QStringList fileNames;
+  foreach (QString resolution, screenResolutions()) {
+    fileNames << WallpaperCache::fileName(today.month(), today.year(),
+                                          resolution);
+  }
+  return mRetries.nextAttempt(fileNames);
+}
+
+/**
+ * Returns when the wallpaper for the given month may next be prefetched, if
+ * an earlier attempt failed, or a null time if nothing is holding it back
+ */
+QDateTime WallpaperGetter::nextPrefetchAttempt(int month, int year) const
+{
+  QStringList keys;
+  foreach (QString resolution, screenResolutions()) {
+    keys << retryKey(WallpaperCache::fileName(month, year, resolution), true);
+  }
+  return mRetries.nextAttempt(keys);
+}
+
+/**
+ * Starts downloading this month's wallpaper, in each of the resolutions
+ * needed for the attached screens.  Screens that need the same resolution
+ * share a download.
  */
 void WallpaperGetter::refreshWallpaper(ProgressReportType progressReportType)
 {
+  mIdleTimer->start();
   int month = QDate::currentDate().month();
   int year = QDate::currentDate().year();
 
-  // Determine screen ratio (widescreen or not)
-  QDesktopWidget* desktop = qobject_cast<Application*>(qApp)->desktop();
-  int primaryScreen = desktop->primaryScreen();
-  QRect screen = desktop->screenGeometry(primaryScreen);
-  double ratio = (double)screen.width() / screen.height();
-  const double widescreen = 16.0 / 10;
-  const double standard = 4.0 / 3;
-  bool closerToWidescreen = (qAbs(ratio - widescreen) < qAbs(ratio - standard));
+  QStringList resolutions = screenResolutions();
+  resolutions.removeDuplicates();
 
-  QString size = closerToWidescreen ? "1280x800" : "1280x960";
+  QStringList queued;
+  bool downloading = false;
+  foreach (QString size, resolutions) {
+    QString filename = WallpaperCache::fileName(month, year, size);
 
-  QString filename =
-    QString("%1-%2-%3.jpg").arg(month, 2, 10, QChar('0')).arg(year).arg(size);
+    if (QFile::exists(mCache.filePath(filename))) {
+      // If the server was asked about this file recently, don't ask again
+      if (needsRevalidating(mCache.entry(filename))) {
+        // A revalidation happens silently; the cached wallpaper is set below
+        WallpaperDownload* download = queueDownload(month, year, size);
+        if (download) {
+          download->setDecoderThread(decoderThread());
+          queued << filename;
+        }
+      }
+      continue;
+    }
 
-  QUrl url = "http://www.omships.org/images/desktops/" + filename;
-  QFile file(mWallpaperDir.path() + "/" + filename);
+    // Someone asking in person needn't wait out the backoff
+    WallpaperDownload* download = findDownload(mCache.filePath(filename));
+    if (download) {
+      // Share the download already under way, whoever started it
+      if (download->property("prefetch").toBool()) {
+        download->setProperty("prefetch", false);
+        if (!hasPendingDownloads(true)) {
+          emit prefetchFinished(!mPrefetchFailed, mPrefetchNotYetAvailable);
+        }
+      }
+    } else {
+      download = queueDownload(month, year, size,
+                               progressReportType == SHOW_PROGRESS_WIDGET);
+      if (!download) {
+        if (progressReportType == SHOW_PROGRESS_WIDGET &&
+            mRetries.isBreakerOpen()) {
+          progressWidget()->reportError(
+            tr("The website has been having trouble, so it is being left "
+               "alone for a while.  The wallpaper will be fetched "
+               "automatically once it has had time to recover."));
+        }
+        continue;
+      }
+      download->setDecoderThread(decoderThread());
+      queued << filename;
+    }
+    downloading = true;
+
+    if (progressReportType == SHOW_PROGRESS_WIDGET) {
+      mProgress.insert(download, ProgressPair(0, 0));
+    }
+  }
 
-  if (file.exists()) {
-    if (canSetWallpaper()) {
-      setWallpaper(file);
+  // Show progress window
+  if (!mProgress.isEmpty()) {
+    progressWidget()->setProgress(0, 1);
+    progressWidget()->show();
+    progressWidget()->raise();
+  }
+
+  // Set whatever we already have straight away, unless we're about to
+  // download a better fit for some screens.  Unless asked in person, files
+  // that are up already (as at login) are left alone; if a revalidation
+  // brings a new version, that is set once it arrives.
+  if (!downloading && canSetWallpaper()) {
+    QStringList files = wallpaperFiles(month, year);
+    if (!files.isEmpty() &&
+        (progressReportType == SHOW_PROGRESS_WIDGET || !isShowing(files))) {
+      setWallpaper(files);
       if (progressReportType == REPORT_WHEN_DONE) {
         reportWallpaperChange();
       }
+    } else if (!files.isEmpty() && mApplyingFiles.isEmpty()) {
+      // Nothing to do, but this month is done all the same
+      emit wallpaperSet();
     }
+  }
+  // If we're going to display a message when done, make a note of it
+  if (downloading && progressReportType == REPORT_WHEN_DONE) {
+    mPendingReport = true;
+  }
+
+  if (!queued.isEmpty()) {
+    queueManifest(queued, false);
+  }
+  pumpQueue();
+}
+
+/**
+ * Starts downloading the wallpaper for the given month into the cache without
+ * setting it, so that it is ready for when the month begins.  The outcome is
+ * reported with prefetchFinished() once every resolution needed has been
+ * tried.
+ */
+void WallpaperGetter::prefetchWallpaper(int month, int year)
+{
+  mIdleTimer->start();
+  QStringList resolutions = screenResolutions();
+  resolutions.removeDuplicates();
+
+  mPrefetchFailed = false;
+  mPrefetchNotYetAvailable = false;
+  QStringList queued;
+  foreach (QString size, resolutions) {
+    QString filename = WallpaperCache::fileName(month, year, size);
+    if (QFile::exists(mCache.filePath(filename))) {
+      continue;
+    }
+    WallpaperDownload* download = queueDownload(month, year, size, false, true);
+    if (download) {
+      queued << filename;
+    } else {
+      mPrefetchFailed = true;
+    }
+  }
+
+  if (!queued.isEmpty()) {
+    queueManifest(queued, false);
+  }
+  if (!hasPendingDownloads(true)) {
+    emit prefetchFinished(!mPrefetchFailed, false);
+  }
+  pumpQueue();
+}
+
+/**
+ * Queues a download of the given wallpaper into the cache.  If a copy is
+ * already cached, the download is a revalidation; if an earlier attempt was
+ * interrupted, it is resumed.  If the same file is already being downloaded,
+ * nothing new is queued.  A prefetch backs off separately from other
+ * requests for the same file.
+ * @returns The download, or NULL if it is already under way or could not be
+ *          set up
+ */
+WallpaperDownload* WallpaperGetter::queueDownload(int month, int year,
+                                                  const QString& resolution,
+                                                  bool ignoreBackoff,
+                                                  bool prefetch)
+{
+  QString filename = WallpaperCache::fileName(month, year, resolution);
+  QString key = retryKey(filename, prefetch);
+  QFile file(mCache.filePath(filename));
+
+  if (findDownload(file.fileName())) {
+    return NULL;
+  }
+
+  // After a failure, the server is left alone for a while
+  if (!mRetries.allow(key, ignoreBackoff)) {
+    qDebug() << "Holding back request for" << filename << "-" <<
+                mRetries.report();
+    return NULL;
+  }
+
+  // The disk queue was asked to create the directory at startup, but it may
+  // not have got there yet, or it may have been removed since
+  bool revalidating = file.exists();
+  if (!revalidating && !mWallpaperDir.exists() &&
+      !mWallpaperDir.mkpath(".")) {
+    mRetries.release(key);
+    progressWidget()->
+      reportError(tr("Unable to create directory:\n") +
+                  mWallpaperDir.path());
+    return NULL;
+  }
+
+  WallpaperDownload* download = createDownload(filename);
+  download->setProperty("month", month);
+  download->setProperty("year", year);
+  download->setProperty("resolution", resolution);
+  download->setProperty("prefetch", prefetch);
+  download->setProperty("retryKey", key);
+  download->setCheckJpeg(true);
+
+  // If we already have a copy, we just ask the server whether it has been
+  // replaced since we fetched it; usually the answer is a bodiless 304.
+  if (revalidating) {
+    CacheIndex::Entry entry = mCache.entry(filename);
+    if (entry.isValid()) {
+      download->setValidators(entry.eTag, entry.lastModified);
+    } else {
+      // Cached before we kept an index; fall back to the file's timestamp
+      QDateTime fileTime = QFileInfo(file).lastModified().toUTC();
+      download->setValidators(QByteArray(),
+        QLocale::c().toString(fileTime, "ddd, dd MMM yyyy hh:mm:ss 'GMT'").
+          toLatin1());
+    }
+    download->setProperty("revalidating", true);
   } else {
-    QNetworkReply* reply = mManager->get(QNetworkRequest(url));
-    connect(reply, SIGNAL(downloadProgress(qint64, qint64)),
-            mProgressWidget.data(), SLOT(setProgress(qint64, qint64)));
+    // Pick up an earlier attempt that was interrupted part way through
+    QString partName =
+      QFileInfo(AtomicFile::tempFileName(download->fileName())).fileName();
+    CacheIndex::Entry entry = mCache.entry(partName);
+    QFileInfo partInfo(mCache.filePath(partName));
+    if (entry.isValid() && partInfo.exists() && partInfo.size() == entry.size) {
+      download->resumeFrom(entry.eTag, entry.lastModified);
+    }
+  }
+
+  connect(download, SIGNAL(downloadProgress(qint64, qint64)),
+          this, SLOT(downloadProgress(qint64, qint64)));
+  connect(download, SIGNAL(finished(WallpaperDownload*)),
+          this, SLOT(loadingFinished(WallpaperDownload*)));
+  mQueuedDownloads << download;
+  return download;
+}
 
-    // If we're going to display a message when done, we tag the reply
-    if (progressReportType == REPORT_WHEN_DONE) {
-      reply->setProperty("reportWhenDone", true);
+/**
+ * Creates a download of the file \a name into the cache, from whichever
+ * mirror has been fastest lately, or the next fastest if that is slow to
+ * respond
+ */
+WallpaperDownload* WallpaperGetter::createDownload(const QString& name)
+{
+  QStringList mirrors = mMirrors.ranked();
+  QList<QUrl> urls;
+  foreach (QString mirror, mirrors) {
+    urls << QUrl(mirror + name);
+  }
+
+  WallpaperDownload* download =
+    new WallpaperDownload(networkManager(), urls.first(), mCache.filePath(name),
+                          this);
+  download->setMirrors(urls, mMirrors.hedgeDelay(mirrors.first()), &mMirrors);
+  download->setDiskQueue(mDiskQueue);
+  return download;
+}
+
+/**
+ * Returns the download queued or under way into the given file, if any
+ */
+WallpaperDownload* WallpaperGetter::findDownload(const QString& fileName) const
+{
+  foreach (WallpaperDownload* download, mQueuedDownloads + mActiveDownloads) {
+    if (download->fileName() == fileName) {
+      return download;
     }
+  }
+  return NULL;
+}
 
-    // Show progress window
-    if (progressReportType == SHOW_PROGRESS_WIDGET) {
-      mProgressWidget->setProgress(0, 1);
-      mProgressWidget->show();
-      mProgressWidget->raise();
+/**
+ * Queues a fetch of the checksum manifest, ahead of any other downloads, so
+ * that they can be checked against it.  Nothing is fetched if our copy was
+ * confirmed recently and lists all of \a fileNames.  Unless \a force is set,
+ * we don't ask more than once an hour, in case the server doesn't publish
+ * one.
+ */
+void WallpaperGetter::queueManifest(const QStringList& fileNames, bool force)
+{
+  QString name = ChecksumManifest::FileName;
+  QString path = mCache.filePath(name);
+  uint now = QDateTime::currentDateTime().toTime_t();
+
+  bool complete = true;
+  foreach (QString fileName, fileNames) {
+    complete = complete && mManifest.contains(fileName);
+  }
+  CacheIndex::Entry entry = mCache.entry(name);
+  if (complete && entry.isValid() && now - entry.checked < revalidateSecs()) {
+    return;
+  }
+  if (!force && mManifestRequested != 0 &&
+      now - mManifestRequested < ManifestRetrySecs) {
+    return;
+  }
+  if (findDownload(path)) {
+    return;
+  }
+  mManifestRequested = now;
+
+  WallpaperDownload* download = createDownload(name);
+  if (entry.isValid() && QFile::exists(path)) {
+    download->setValidators(entry.eTag, entry.lastModified);
+  }
+  download->setProperty("manifest", true);
+  connect(download, SIGNAL(finished(WallpaperDownload*)),
+          this, SLOT(loadingFinished(WallpaperDownload*)));
+  mQueuedDownloads.prepend(download);
+}
+
+/**
+ * Starts queued downloads while there are connections to spare.  While the
+ * checksum manifest is being fetched, nothing else is started, since the
+ * other downloads need it.
+ */
+void WallpaperGetter::pumpQueue()
+{
+  foreach (WallpaperDownload* download, mActiveDownloads) {
+    if (download->property("manifest").toBool()) {
+      return;
+    }
+  }
+
+  while (!mQueuedDownloads.isEmpty() &&
+         mActiveDownloads.size() < mMaxConnections) {
+    WallpaperDownload* download = mQueuedDownloads.takeFirst();
+    mActiveDownloads << download;
+    if (download->property("manifest").toBool()) {
+      startDownload(download);
+      return;
+    }
+    QString name = QFileInfo(download->fileName()).fileName();
+    QByteArray hash = mManifest.hash(name);
+    download->setExpectedHash(hash);
+
+    // A new wallpaper may be on a neighbour's machine already, but we only
+    // take it from them if we know what it should be
+    if (mPeers && !hash.isEmpty() &&
+        !download->property("revalidating").toBool()) {
+      download->setProperty("awaitingPeers", true);
+      mPeers->lookup(name, hash);
+      continue;
+    }
+    startDownload(download);
+  }
+}
+
+/**
+ * Starts an active download.  In a shared cache, if another process is
+ * already fetching the same file, we wait for it instead.
+ */
+void WallpaperGetter::startDownload(WallpaperDownload* download)
+{
+  if (mShared) {
+    LockFile* lock = new LockFile(download->fileName() + ".lock");
+    if (!lock->tryLock()) {
+      delete lock;
+      download->setProperty("awaitingLock", true);
+      mLockPollTimer->start();
+      return;
+    }
+    mDownloadLocks.insert(download, lock);
+    if (!mLockRefreshTimer->isActive()) {
+      mLockRefreshTimer->start();
+    }
+  }
+
+  if (!download->start()) {
+    // Report the failure as though the download had run
+    loadingFinished(download);
+  }
+}
+
+/**
+ * Checks on the downloads waiting for other processes.  Once the other
+ * process is done, the file it fetched only needs revalidating, and if it
+ * failed, we try ourselves.
+ */
+void WallpaperGetter::pollLocks()
+{
+  bool waiting = false;
+  foreach (WallpaperDownload* download, mActiveDownloads) {
+    if (!download->property("awaitingLock").toBool()) {
+      continue;
+    }
+    if (LockFile::isLocked(download->fileName() + ".lock")) {
+      waiting = true;
+      continue;
+    }
+    download->setProperty("awaitingLock", false);
+    CacheIndex::Entry entry =
+      mCache.entry(QFileInfo(download->fileName()).fileName());
+    if (entry.isValid() && QFile::exists(download->fileName())) {
+      // The other process has only just fetched or checked the file, in
+      // which case there's nothing to ask the server
+      if (!needsRevalidating(entry)) {
+        download->setProperty("reused", true);
+        download->finishUnchanged();
+        continue;
+      }
+      download->setValidators(entry.eTag, entry.lastModified);
+    }
+    startDownload(download);
+  }
+  if (!waiting) {
+    mLockPollTimer->stop();
+  }
+}
+
+/**
+ * Keeps the locks we hold in a shared cache fresh while their downloads and
+ * conversions run
+ */
+void WallpaperGetter::refreshLocks()
+{
+  if (mDownloadLocks.isEmpty() && mPipelineLocks.isEmpty()) {
+    mLockRefreshTimer->stop();
+    return;
+  }
+  foreach (LockFile* lock, mDownloadLocks.values() + mPipelineLocks) {
+    lock->refresh();
+  }
+}
+
+/**
+ * Called when we know whether any peer has the file \a name.  If one does,
+ * the download asks it first, and falls back on the mirrors.
+ */
+void WallpaperGetter::peerLookupFinished(const QString& name, const QUrl& url)
+{
+  foreach (WallpaperDownload* download, mActiveDownloads) {
+    if (download->property("awaitingPeers").toBool() &&
+        QFileInfo(download->fileName()).fileName() == name) {
+      download->setProperty("awaitingPeers", false);
+      if (url.isValid()) {
+        download->preferUrl(url, PeerHedgeMsecs);
+      }
+      startDownload(download);
+      return;
     }
   }
 }
 
+/**
+ * Returns true if any prefetches (or, if \a prefetch is false, any other
+ * downloads) are queued or running
+ */
+bool WallpaperGetter::hasPendingDownloads(bool prefetch) const
+{
+  foreach (WallpaperDownload* download, mQueuedDownloads + mActiveDownloads) {
+    if (download->property("prefetch").toBool() == prefetch) {
+      return true;
+    }
+  }
+  return false;
+}
+
 /**
  * Convenience slot
  */
@@ -144,43 +1062,234 @@ void WallpaperGetter::refreshWallpaperWithProgress()
 }
 
 /**
- * Called when the wallpaper has finished downloading
+ * Updates the progress widget with the combined progress of all downloads
+ * being shown
  */
-void WallpaperGetter::loadingFinished(QNetworkReply* reply)
+void WallpaperGetter::downloadProgress(qint64 bytesReceived, qint64 bytesTotal)
 {
-  reply->deleteLater();
+  WallpaperDownload* download = static_cast<WallpaperDownload*>(sender());
+  if (!mProgress.contains(download)) {
+    return;
+  }
+  mProgress.insert(download, ProgressPair(bytesReceived, bytesTotal));
 
-  if (reply->error() != QNetworkReply::NoError) {
-    reportNetworkError(reply);
+  qint64 received = 0;
+  qint64 total = 0;
+  foreach (const ProgressPair& progress, mProgress) {
+    received += progress.first;
+    total += qMax(progress.second, progress.first);
+  }
+  progressWidget()->setProgress(received, qMax(total, qint64(1)));
+}
+
+/**
+ * Called when a download has finished.  By this point the file is already
+ * safely on disk (or the download has failed and the previously cached
+ * wallpaper is untouched).
+ */
+void WallpaperGetter::loadingFinished(WallpaperDownload* download)
+{
+  // Others waiting for this file may go ahead once it is in the index
+  QScopedPointer<LockFile> lock(mDownloadLocks.take(download));
+
+  download->deleteLater();
+  mActiveDownloads.removeAll(download);
+  bool showingProgress = (mProgress.remove(download) > 0);
+
+  bool revalidating = download->property("revalidating").toBool();
+  bool prefetch = download->property("prefetch").toBool();
+  int month = download->property("month").toInt();
+  int year = download->property("year").toInt();
+
+  QFile file(download->fileName());
+  QString filename = QFileInfo(file).fileName();
+  // (A prefetch that has since been asked for in person counts as a request
+  // for the current month)
+  QString key = retryKey(filename, prefetch);
+  QString requestKey = download->property("retryKey").toString();
+
+  CacheIndex::Entry entry;
+  entry.eTag = download->eTag();
+  entry.lastModified = download->lastModified();
+  entry.size = download->size();
+  entry.hash = download->contentHash();
+  entry.month = month;
+  entry.year = year;
+  entry.resolution = download->property("resolution").toByteArray();
+
+  if (download->property("cleared").toBool()) {
+    // Whatever the download wrote has gone with the rest of the cache
+    mRetries.release(download->property("retryKey").toString());
+    if (prefetch && !hasPendingDownloads(true)) {
+      emit prefetchFinished(false, false);
+    }
+    if (!hasPendingDownloads(false)) {
+      mPendingApply = false;
+      mPendingReport = false;
+      mDecodedImages.clear();
+    }
+    if (mProgress.isEmpty() && mProgressWidget) {
+      mProgressWidget->hide();
+    }
+    pumpQueue();
     return;
   }
 
-  if (mWallpaperDir.exists()) {
-    // Clear out directory contents to avoid it just building
-    clearCache();
-  } else {
-    // Create our cache directory as it doesn't exist
-    if (!mWallpaperDir.mkpath(".")) {
-      mProgressWidget->
-        reportError(tr("Unable to create directory:\n") +
-                    mWallpaperDir.path());
-      return;
+  if (download->property("manifest").toBool()) {
+    // Without a manifest, downloads are only checked for being whole JPEGs
+    if (download->result() == WallpaperDownload::Success) {
+      mCache.insert(filename, entry);
+      mManifest.load(file.fileName());
+    } else if (download->result() == WallpaperDownload::NotModified) {
+      mCache.markChecked(filename);
+    }
+    pumpQueue();
+    return;
+  }
+
+  switch (download->result()) {
+    case WallpaperDownload::NotModified:
+      mRetries.recordSuccess(key);
+      if (mCache.entry(filename).isValid()) {
+        // (A file another process fetched was checked when it did so)
+        if (!download->property("reused").toBool()) {
+          mCache.markChecked(filename);
+        }
+      } else {
+        // Bring a file cached before we kept an index under management
+        entry.size = file.size();
+        mCache.insert(filename, entry);
+      }
+      // Another process may have fetched the file while we waited for it
+      if (!revalidating && !prefetch) {
+        mPendingApply = true;
+      }
+      break;
+    case WallpaperDownload::NetworkFailure:
+      if (download->networkError() != QNetworkReply::OperationCanceledError) {
+        mRetries.recordFailure(
+          key, RetryQueue::classify(download->networkError(),
+                                    download->httpStatus()));
+        if (!prefetch) {
+          emit refreshFailed();
+        }
+      } else {
+        mRetries.release(requestKey);
+      }
+
+      // Remember what we need in order to resume next time
+      if (download->hasPartialFile()) {
+        mCache.insert(
+          QFileInfo(AtomicFile::tempFileName(download->fileName())).fileName(),
+          entry);
+      }
+
+      // A failed revalidation is harmless; we still have the cached copy
+      if (prefetch) {
+        mPrefetchFailed = true;
+        if (download->networkError() == QNetworkReply::ContentNotFoundError) {
+          mPrefetchNotYetAvailable = true;
+        }
+      } else if (!revalidating && download->networkError() !=
+                                    QNetworkReply::OperationCanceledError) {
+        reportNetworkError(download->networkError(), download->errorString());
+      }
+      break;
+    case WallpaperDownload::VerificationFailure:
+      // The server answered, so the breaker may let the retry through
+      mRetries.release(requestKey);
+
+      // Try again, with a fresh copy of the manifest in case it was that
+      // which was out of date
+      if (download->property("attempts").toInt() + 1 < MaxAttempts) {
+        QString resolution = download->property("resolution").toString();
+        WallpaperDownload* retry =
+          queueDownload(month, year, resolution, false, prefetch);
+        if (retry) {
+          retry->setProperty("attempts",
+                             download->property("attempts").toInt() + 1);
+          if (!prefetch) {
+            retry->setDecoderThread(decoderThread());
+          }
+          if (showingProgress) {
+            mProgress.insert(retry, ProgressPair(0, 0));
+          }
+          queueManifest(QStringList() << filename, true);
+          break;
+        }
+      }
+      // Fall through
+    case WallpaperDownload::FileFailure:
+      // Failing on our side says nothing about the server
+      if (download->result() == WallpaperDownload::FileFailure) {
+        mRetries.release(requestKey);
+      }
+      if (prefetch) {
+        mPrefetchFailed = true;
+      } else {
+        progressWidget()->reportError(download->errorString());
+      }
+      break;
+    case WallpaperDownload::Success:
+      mRetries.recordSuccess(key);
+
+      // Only now that the new file is in place may older entries be evicted to
+      // make room for it
+      mCache.insert(filename, entry);
+
+      // A prefetched wallpaper waits in the cache until its month begins
+      if (!prefetch) {
+        mPendingApply = true;
+        if (!download->image().isNull()) {
+          mDecodedImages.insert(filename, download->image());
+        }
+        // Display a message if requested, or if the server replaced the image
+        // we had already set
+        if (revalidating) {
+          mPendingReport = true;
+        }
+      }
+      break;
+  }
+
+  if (prefetch && !hasPendingDownloads(true)) {
+    emit prefetchFinished(!mPrefetchFailed, mPrefetchNotYetAvailable);
+  }
+
+  pumpQueue();
+
+  // Once every resolution for this month has arrived, set them all together
+  if (!prefetch && !hasPendingDownloads(false)) {
+    QDate today = QDate::currentDate();
+    if (mPendingApply && month == today.month() && year == today.year()) {
+      applyWallpaper();
     }
+    mPendingApply = false;
+    mPendingReport = false;
+    mDecodedImages.clear();
   }
 
-  QString filename =
-    reply->url().path().split('/', QString::SkipEmptyParts).last();
-  QFile file(mWallpaperDir.path() + '/' + filename);
-  if (!file.open(QIODevice::WriteOnly)) {
-    mProgressWidget->
-      reportError(tr("Unable to write to file:\n") + file.fileName());
+  if (mProgress.isEmpty() && mProgressWidget) {
+    mProgressWidget->hide();
+  }
+}
+
+/**
+ * Sets this month's wallpaper from the cache after new files have arrived
+ */
+void WallpaperGetter::applyWallpaper()
+{
+  QDate today = QDate::currentDate();
+  QStringList files = wallpaperFiles(today.month(), today.year());
+  bool report = mPendingReport;
+  mPendingApply = false;
+  mPendingReport = false;
+  if (files.isEmpty()) {
     return;
   }
-  file.write(reply->readAll());
-  file.close();
 
   if (canSetWallpaper()) {
-    setWallpaper(file);
+    setWallpaper(files);
   } else {
     const QString message =
       tr("Your wallpaper has been downloaded to the following directory:\n\n%1"
@@ -188,72 +1297,267 @@ void WallpaperGetter::loadingFinished(QNetworkReply* reply)
          "your platform, so you will have to make your own arrangements for "
          "your wallpaper to be updated when a new image is downloaded.").
         arg(mWallpaperDir.path()).arg(APP_NAME);
-    mProgressWidget->reportSuccess(message);
+    progressWidget()->reportSuccess(message);
   }
 
-  // Display a message if requested
-  if (reply->property("reportWhenDone").toBool()) {
+  if (report) {
     reportWallpaperChange();
   }
 }
 
 /**
  * Reports the given network error using the progress widget
- * @param code Error code to report
+ * @param error Error code to report
+ * @param errorString Description to fall back on for unexpected errors
  */
-void WallpaperGetter::reportNetworkError(const QNetworkReply* reply)
+void WallpaperGetter::reportNetworkError(QNetworkReply::NetworkError error,
+                                         const QString& errorString)
 {
-  QString errorString;
-  switch (reply->error()) {
+  QString message;
+  switch (error) {
     case QNetworkReply::ContentNotFoundError:
-      errorString = tr("This month's wallpaper could not be found in the "
-                       "expected place on the website.  It could be that it "
-                       "has not yet been made available.");
+      message = tr("This month's wallpaper could not be found in the "
+                   "expected place on the website.  It could be that it "
+                   "has not yet been made available.");
       break;
     case QNetworkReply::HostNotFoundError:
-      errorString = tr("The website is not available.  Are you sure you're "
-                       "connected to the internet?");
+      message = tr("The website is not available.  Are you sure you're "
+                   "connected to the internet?");
       break;
     default:
-      errorString = reply->errorString();
+      message = errorString;
       break;
   }
-  mProgressWidget->reportError(errorString);
+  progressWidget()->reportError(message);
 }
 
 /**
- * Set the wallpaper to the given file
+ * Set the wallpaper to the given files, one per screen.  Unless disabled,
+ * each is first fitted to its screen's exact size, and on Windows the
+ * primary screen's is converted to a BMP.  That work happens in the
+ * background, and results are kept in the cache so that it is only done once
+ * per image; the desktop is updated when it is finished.
  */
-void WallpaperGetter::setWallpaper(QFile& file)
+void WallpaperGetter::setWallpaper(const QStringList& sourceFileNames)
 {
-  if (MACOS_X) {
-    QProcess proc;
-    QDir scriptDir(QCoreApplication::applicationDirPath());
-    scriptDir.cd("../Resources/Scripts");
-    proc.setWorkingDirectory(scriptDir.path());
-    proc.start("./setWallpaper", QStringList() << file.fileName());
-    proc.waitForFinished();
-  } else if (WINDOWS) {
+  QDesktopWidget* desktop = qobject_cast<Application*>(qApp)->desktop();
+  mApplyingSources = sourceFileNames;
+  QSettings settings;
+  bool fitToScreen = settings.value("wallpaper/fitToScreen", true).toBool();
+
+  ImagePipeline::TaskList tasks;
+  bool needPipeline = false;
+  for (int screen = 0; screen < sourceFileNames.size(); screen++) {
+    QString fileName = sourceFileNames[screen];
+    QString name = QFileInfo(fileName).fileName();
+    QByteArray hash = mCache.entry(name).hash;
+    mCache.touch(name);
+
+    ImagePipeline::Task task;
+    task.source = fileName;
+
+    if (fitToScreen) {
+      QSize size = desktop->screenGeometry(screen).size();
+      QString fittedName = QString("%1@%2x%3.jpg").
+                             arg(QFileInfo(fileName).completeBaseName()).
+                             arg(size.width()).arg(size.height());
+      if (isDerivedFileCurrent(fittedName, hash)) {
+        task.source = mCache.filePath(fittedName);
+      } else if (QImageReader(fileName).size() == size) {
+        // The image already fits the screen exactly, so the source stands in
+        // for the fitted file; only its header needs reading to know that
+      } else {
+        task.size = size;
+        task.fittedOutput = mCache.filePath(fittedName);
+        needPipeline = true;
+      }
+    }
+
     // Convert the JPG to BMP (for older versions of Windows)
-    QString path = file.fileName();
-    QString dest = mWallpaperDir.path() + "/Wallpaper.bmp";
-    QImage(path).save(dest);
+    if (WINDOWS && screen == desktop->primaryScreen()) {
+      QString bmpName =
+        QFileInfo(task.fittedOutput.isEmpty() ? task.source :
+                                                task.fittedOutput).
+          completeBaseName() + ".bmp";
+      if (isDerivedFileCurrent(bmpName, hash)) {
+        task.source = mCache.filePath(bmpName);
+      } else {
+        task.bmpOutput = mCache.filePath(bmpName);
+        needPipeline = true;
+      }
+    }
 
-    // Set the wallpaper using the Win API
-    QByteArray pathByteArray = QDir::toNativeSeparators(dest).toLatin1();
-#ifdef Q_WS_WIN
-    SystemParametersInfoA(SPI_SETDESKWALLPAPER, 0, (void*)pathByteArray.data(),
-                          SPIF_UPDATEINIFILE | SPIF_SENDCHANGE);
-#endif
+    // If the image was decoded as it downloaded, save decoding it again
+    if (task.source == fileName) {
+      task.image = mDecodedImages.value(name);
+    }
+
+    task.key = name;
+    tasks << task;
   }
-  emit wallpaperSet();
+
+  if (needPipeline && !lockOutputs(tasks)) {
+    // Another process is preparing the same files; use its results once
+    // it's done
+    mWaitingSources = sourceFileNames;
+    QTimer::singleShot(1000, this, SLOT(retrySetWallpaper()));
+  } else if (needPipeline) {
+    mPipeline->process(tasks);
+  } else {
+    // Everything is ready already
+    QStringList fileNames;
+    foreach (const ImagePipeline::Task& task, tasks) {
+      fileNames << task.source;
+    }
+    applyToDesktop(fileNames);
+  }
+}
+
+/**
+ * Called to try setting the wallpaper again after waiting for another
+ * process
+ */
+void WallpaperGetter::retrySetWallpaper()
+{
+  QStringList sourceFileNames = mWaitingSources;
+  mWaitingSources.clear();
+  if (!sourceFileNames.isEmpty()) {
+    setWallpaper(sourceFileNames);
+  }
+}
+
+/**
+ * In a shared cache, takes the locks on the files \a tasks will write, so
+ * that no other process prepares them at the same time
+ * @returns false if another process holds any of them, in which case none
+ *          are taken
+ */
+bool WallpaperGetter::lockOutputs(const ImagePipeline::TaskList& tasks)
+{
+  if (!mShared) {
+    return true;
+  }
+
+  QList<LockFile*> locks;
+  foreach (const ImagePipeline::Task& task, tasks) {
+    QStringList outputs;
+    outputs << task.fittedOutput << task.bmpOutput;
+    foreach (QString output, outputs) {
+      if (output.isEmpty()) {
+        continue;
+      }
+      LockFile* lock = new LockFile(output + ".lock");
+      locks << lock;
+      if (!lock->tryLock()) {
+        qDeleteAll(locks);
+        return false;
+      }
+    }
+  }
+  mPipelineLocks << locks;
+  if (!mLockRefreshTimer->isActive()) {
+    mLockRefreshTimer->start();
+  }
+  return true;
+}
+
+/**
+ * Returns true if the file \a name, derived from a downloaded wallpaper, is in
+ * the cache and was derived from the version whose hash is \a sourceHash
+ */
+bool WallpaperGetter::isDerivedFileCurrent(const QString& name,
+                                           const QByteArray& sourceHash)
+{
+  CacheIndex::Entry entry = mCache.entry(name);
+  if (entry.isValid() && entry.hash == sourceHash &&
+      QFile::exists(mCache.filePath(name))) {
+    mCache.touch(name);
+    return true;
+  }
+  return false;
 }
 
 /**
- * Displays a message to the user telling him/her that the wallpaper has changed
+ * Called when the image pipeline has prepared the files for the desktop.
+ * Records the new files in the cache, keyed by the hash of the downloaded
+ * wallpaper they came from, then sets them.
  */
-void WallpaperGetter::reportWallpaperChange()
+void WallpaperGetter::imagesReady(const ImagePipeline::TaskList& tasks)
 {
-  qobject_cast<Application*>(qApp)->
-    showTrayMessage(tr("Your wallpaper has been updated."));
+  QStringList fileNames;
+  for (int i = 0; i < tasks.size(); i++) {
+    const ImagePipeline::Task& task = tasks[i];
+    CacheIndex::Entry derived = mCache.entry(task.key);
+    derived.eTag.clear();
+    derived.lastModified.clear();
+
+    QStringList outputs;
+    outputs << task.fittedOutput << task.bmpOutput;
+    foreach (QString output, outputs) {
+      QFileInfo info(output);
+      if (task.ok && !output.isEmpty() && info.exists() &&
+          !isDerivedFileCurrent(info.fileName(), derived.hash)) {
+        derived.size = info.size();
+        mCache.insert(info.fileName(), derived);
+      }
+    }
+
+    // If preparing the image failed, we still have the original to fall back
+    // on; we're never worse off than before
+    fileNames << (task.ok ? task.result : mCache.filePath(task.key));
+  }
+
+  // The files are in the index, so others waiting for them can use them
+  qDeleteAll(mPipelineLocks);
+  mPipelineLocks.clear();
+
+  applyToDesktop(fileNames);
+}
+
+/**
+ * Hands the given files, one per screen, to the desktop.  wallpaperSet() is
+ * emitted once the desktop has taken them.
+ */
+void WallpaperGetter::applyToDesktop(const QStringList& fileNames)
+{
+  QDesktopWidget* desktop = qobject_cast<Application*>(qApp)->desktop();
+  mApplyingFiles = fileNames;
+  mSetter->start(fileNames, desktop->primaryScreen());
+}
+
+/**
+ * Called when the desktop has been updated, or has failed to be
+ */
+void WallpaperGetter::setterFinished(bool succeeded,
+                                     const QString& errorString)
+{
+  if (succeeded) {
+    // Remember what was set, so that it can be set again at the next login
+    // before anything else happens
+    QSettings settings;
+    QDate today = QDate::currentDate();
+    settings.setValue("state/wallpaperFiles", mApplyingFiles);
+    settings.setValue("state/sourceFiles", mApplyingSources);
+    settings.setValue("state/month", today.month());
+    settings.setValue("state/year", today.year());
+    settings.setValue("state/screens", screenLayout());
+
+    // Keep what we're showing, and anything derived from it, from being
+    // evicted, even by other users of a shared cache
+    QStringList names;
+    foreach (QString fileName, mApplyingFiles) {
+      if (QFileInfo(fileName).dir() == mWallpaperDir) {
+        names << QFileInfo(fileName).fileName();
+      }
+    }
+    mCache.pin(names, userName());
+  } else {
+    progressWidget()->reportError(tr("Unable to set the wallpaper:\n") +
+                                 errorString);
+  }
+  mApplyingFiles.clear();
+  mApplyingSources.clear();
+  // Even on failure, the month counts as done, so that we don't try again
+  // every minute; the wallpaper can still be set from the menu
+  emit wallpaperSet();
 }
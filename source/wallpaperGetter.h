@@ -31,37 +31,123 @@
 
 #include <QtNetwork>
 #include "progressWidget.h"
+#include "wallpaperCache.h"
+#include "imagePipeline.h"
+#include "checksumManifest.h"
+#include "mirrorScoreboard.h"
+#include "retryQueue.h"
 #include "defines.h"
 
+class WallpaperDownload;
+class WallpaperSetter;
+class PeerCache;
+class LockFile;
+class DiskQueue;
+
 class WallpaperGetter : public QObject
 {
   Q_OBJECT
 
   public:
-    static const bool canSetWallpaper() { return MACOS_X || WINDOWS; }
     WallpaperGetter(QObject* parent = 0);
     ~WallpaperGetter();
+    bool canSetWallpaper() const { return mSetter != NULL; }
     enum ProgressReportType { REPORT_WHEN_DONE, SHOW_PROGRESS_WIDGET };
     void refreshWallpaper(ProgressReportType progressReportType);
+    void prefetchWallpaper(int month, int year);
+    bool isCached(int month, int year) const;
+    bool applyCachedWallpaper();
+    QDateTime nextRefreshAttempt() const;
+    QDateTime nextPrefetchAttempt(int month, int year) const;
 
   signals:
     void wallpaperSet();
+    void prefetchFinished(bool succeeded, bool notYetAvailable);
+    void refreshFailed();
 
   public slots:
     void clearCache();
     void refreshWallpaperQuietly();
     void refreshWallpaperWithProgress();
+    void cancelRefresh();
 
   private slots:
-    void loadingFinished(QNetworkReply* reply);
-    void setWallpaper(QFile& file);
-    void reportNetworkError(const QNetworkReply* reply);
+    void loadingFinished(WallpaperDownload* download);
+    void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void setWallpaper(const QStringList& sourceFileNames);
+    void imagesReady(const ImagePipeline::TaskList& tasks);
+    void setterFinished(bool succeeded, const QString& errorString);
+    void peerLookupFinished(const QString& name, const QUrl& url);
+    void pollLocks();
+    void refreshLocks();
+    void retrySetWallpaper();
+    void releaseIdleResources();
+    void reportNetworkError(QNetworkReply::NetworkError error,
+                            const QString& errorString);
     void reportWallpaperChange();
 
   private:
-    QSharedPointer<QNetworkAccessManager> mManager;
+    typedef QPair<qint64, qint64> ProgressPair;
+    QNetworkAccessManager* mManager;
     QSharedPointer<ProgressWidget> mProgressWidget;
     QDir mWallpaperDir;
+    WallpaperCache mCache;
+    QList<WallpaperDownload*> mQueuedDownloads;
+    QList<WallpaperDownload*> mActiveDownloads;
+    int mMaxConnections;
+    QHash<WallpaperDownload*, ProgressPair> mProgress;
+    bool mPendingApply;
+    bool mPendingReport;
+    bool mPrefetchFailed;
+    bool mPrefetchNotYetAvailable;
+    ImagePipeline* mPipeline;
+    QThread* mDecoderThread;
+    bool mDecodeWhileDownloading;
+    QHash<QString, QImage> mDecodedImages;
+    WallpaperSetter* mSetter;
+    MirrorScoreboard mMirrors;
+    RetryQueue mRetries;
+    ChecksumManifest mManifest;
+    uint mManifestRequested;
+    PeerCache* mPeers;
+    bool mShared;
+    QTimer* mLockPollTimer;
+    QTimer* mLockRefreshTimer;
+    QHash<WallpaperDownload*, LockFile*> mDownloadLocks;
+    QList<LockFile*> mPipelineLocks;
+    QStringList mWaitingSources;
+    QTimer* mIdleTimer;
+    QThread* mDiskThread;
+    DiskQueue* mDiskQueue;
+    QStringList mApplyingFiles;
+    QStringList mApplyingSources;
+
+    QNetworkAccessManager* networkManager();
+    ProgressWidget* progressWidget();
+    QThread* decoderThread();
+    bool isBusy() const;
+    bool isShowing(const QStringList& sourceFileNames) const;
+
+    uint revalidateSecs() const;
+    bool needsRevalidating(const CacheIndex::Entry& entry) const;
+    QStringList screenResolutions() const;
+    QStringList wallpaperFiles(int month, int year) const;
+    WallpaperDownload* queueDownload(int month, int year,
+                                     const QString& resolution,
+                                     bool ignoreBackoff = false,
+                                     bool prefetch = false);
+    WallpaperDownload* createDownload(const QString& name);
+    WallpaperDownload* findDownload(const QString& fileName) const;
+    void cancelDownloads(const QList<WallpaperDownload*>& downloads);
+    void queueManifest(const QStringList& fileNames, bool force);
+    void pumpQueue();
+    void startDownload(WallpaperDownload* download);
+    bool hasPendingDownloads(bool prefetch) const;
+    void applyWallpaper();
+    bool isDerivedFileCurrent(const QString& name,
+                              const QByteArray& sourceHash);
+    bool lockOutputs(const ImagePipeline::TaskList& tasks);
+    void applyToDesktop(const QStringList& fileNames);
 };
 
 #endif
@@ -0,0 +1,638 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "wallpaperSetter.moc"
+#include "defines.h"
+
+#ifdef Q_WS_WIN
+#include <windows.h>
+#endif
+
+namespace
+{
+  // How long any one command, or blocking call, may take before we give up
+  // on it, unless "wallpaper/setterTimeoutSecs" says otherwise
+  const int DefaultTimeoutSecs = 30;
+
+  // How long each window has to acknowledge a new Windows wallpaper
+  const int BroadcastTimeoutMsecs = 2000;
+
+  /**
+   * Returns true if we're running under the given desktop environment
+   */
+  bool desktopIs(const QString& desktop)
+  {
+    QString current = QString::fromLocal8Bit(qgetenv("XDG_CURRENT_DESKTOP"));
+    if (current.isEmpty()) {
+      current = QString::fromLocal8Bit(qgetenv("DESKTOP_SESSION"));
+    }
+    foreach (QString name, current.split(':', QString::SkipEmptyParts)) {
+      if (name.compare(desktop, Qt::CaseInsensitive) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+
+  /**
+   * Runs the script in the application bundle, which hands an image to each
+   * desktop in turn
+   */
+  class MacScriptSetter : public CommandSetter
+  {
+    public:
+      QString name() const { return "macos"; }
+
+      static QString script()
+      {
+        QDir scriptDir(QCoreApplication::applicationDirPath());
+        scriptDir.cd("../Resources/Scripts");
+        return scriptDir.absoluteFilePath("setWallpaper");
+      }
+
+      static bool isAvailable()
+      {
+        return MACOS_X && QFileInfo(script()).isExecutable();
+      }
+
+    protected:
+      CommandList commands(const QStringList& fileNames, int) const
+      {
+        return CommandList() << Command(script(), fileNames);
+      }
+  };
+
+
+  /**
+   * Sets the Windows wallpaper to the primary screen's image, then tells the
+   * other windows about it, giving up on any window that's hung.  Blocks, so
+   * is run on a worker thread.
+   */
+  bool setWin32Wallpaper(const QStringList& fileNames, int primaryScreen)
+  {
+    QByteArray path = QDir::toNativeSeparators(
+      fileNames.value(primaryScreen, fileNames.value(0))).toLatin1();
+    bool succeeded = false;
+#ifdef Q_WS_WIN
+    succeeded = SystemParametersInfoA(SPI_SETDESKWALLPAPER, 0,
+                                      (void*)path.data(), SPIF_UPDATEINIFILE);
+    if (succeeded) {
+      SendMessageTimeoutA(HWND_BROADCAST, WM_SETTINGCHANGE,
+                          SPI_SETDESKWALLPAPER, 0, SMTO_ABORTIFHUNG,
+                          BroadcastTimeoutMsecs, NULL);
+    }
+#else
+    Q_UNUSED(path);
+#endif
+    return succeeded;
+  }
+
+
+  /**
+   * Uses the Win32 API.  Only the primary screen's image is used.
+   */
+  class Win32Setter : public BlockingSetter
+  {
+    public:
+      Win32Setter() : BlockingSetter(setWin32Wallpaper) {}
+
+      QString name() const { return "win32"; }
+
+      static bool isAvailable()
+      {
+        return WINDOWS;
+      }
+
+    protected:
+
+      QString failureMessage() const
+      {
+        return tr("Windows refused to set the wallpaper.");
+      }
+  };
+
+
+  /**
+   * Sets the GNOME background (also used by Unity and Budgie).  GNOME has
+   * one image across all screens, so the primary screen's is used.
+   */
+  class GnomeSetter : public CommandSetter
+  {
+    public:
+      QString name() const { return "gnome"; }
+
+      static bool isAvailable()
+      {
+        return (desktopIs("GNOME") || desktopIs("Unity") ||
+                desktopIs("Budgie")) &&
+               !findExecutable(QStringList() << "gsettings").isEmpty();
+      }
+
+    protected:
+      CommandList commands(const QStringList& fileNames,
+                           int primaryScreen) const
+      {
+        QString gsettings = findExecutable(QStringList() << "gsettings");
+        QString uri = QUrl::fromLocalFile(
+          fileNames.value(primaryScreen, fileNames.value(0))).toString();
+        QString schema = "org.gnome.desktop.background";
+        CommandList commands;
+        commands << Command(gsettings, QStringList() << "set" << schema <<
+                                         "picture-uri" << uri);
+        // Only newer versions have a separate setting for the dark style
+        commands << Command(gsettings, QStringList() << "set" << schema <<
+                                         "picture-uri-dark" << uri, true);
+        return commands;
+      }
+  };
+
+
+  /**
+   * Sets the image on each Plasma desktop through Plasma's scripting
+   * interface
+   */
+  class KdeSetter : public CommandSetter
+  {
+    public:
+      QString name() const { return "kde"; }
+
+      static QString qdbus()
+      {
+        return findExecutable(QStringList() << "qdbus" << "qdbus6" <<
+                                               "qdbus-qt5");
+      }
+
+      static bool isAvailable()
+      {
+        return desktopIs("KDE") && !qdbus().isEmpty();
+      }
+
+    protected:
+      CommandList commands(const QStringList& fileNames, int) const
+      {
+        QStringList quoted;
+        foreach (QString fileName, fileNames) {
+          QString escaped = fileName;
+          escaped.replace("\\", "\\\\").replace("\"", "\\\"");
+          quoted << "\"file://" + escaped + "\"";
+        }
+        QString script = QString(
+          "var files = [%1];"
+          "var all = desktops();"
+          "for (var i = 0; i < all.length; i++) {"
+          "  var d = all[i];"
+          "  d.wallpaperPlugin = \"org.kde.image\";"
+          "  d.currentConfigGroup = [\"Wallpaper\", \"org.kde.image\","
+          "                          \"General\"];"
+          "  d.writeConfig(\"Image\", files[Math.min(i, files.length - 1)]);"
+          "}").arg(quoted.join(", "));
+        return CommandList() <<
+          Command(qdbus(), QStringList() << "org.kde.plasmashell" <<
+                             "/PlasmaShell" <<
+                             "org.kde.PlasmaShell.evaluateScript" << script);
+      }
+  };
+
+
+  /**
+   * Sets every XFCE backdrop.  XFCE names its backdrops by monitor
+   * connector rather than screen number, so they all get the primary
+   * screen's image.
+   */
+  class XfceSetter : public CommandSetter
+  {
+    public:
+      QString name() const { return "xfce"; }
+
+      static QString xfconfQuery()
+      {
+        return findExecutable(QStringList() << "xfconf-query");
+      }
+
+      static bool isAvailable()
+      {
+        return desktopIs("XFCE") && !xfconfQuery().isEmpty();
+      }
+
+    protected:
+      CommandList commands(const QStringList&, int) const
+      {
+        // First find out which backdrops there are
+        return CommandList() <<
+          Command(xfconfQuery(), QStringList() << "-c" << "xfce4-desktop" <<
+                                   "-l");
+      }
+
+      CommandList followOn(const Command& command, const QByteArray& output,
+                           const QStringList& fileNames,
+                           int primaryScreen) const
+      {
+        if (!command.arguments.contains("-l")) {
+          return CommandList();
+        }
+        QString fileName = fileNames.value(primaryScreen, fileNames.value(0));
+        QStringList base = QStringList() << "-c" << "xfce4-desktop";
+
+        CommandList commands;
+        foreach (QByteArray line, output.split('\n')) {
+          QString property = QString::fromLocal8Bit(line).trimmed();
+          if (property.endsWith("/last-image")) {
+            commands << Command(xfconfQuery(), QStringList(base) << "-p" <<
+                                                 property << "-s" << fileName);
+          }
+        }
+        if (commands.isEmpty()) {
+          // Nothing set yet; create the property for the first backdrop
+          commands << Command(xfconfQuery(), QStringList(base) << "-p" <<
+                                "/backdrop/screen0/monitor0/workspace0/"
+                                "last-image" << "-n" << "-t" << "string" <<
+                                "-s" << fileName);
+        }
+        return commands;
+      }
+  };
+
+
+  /**
+   * Sets the root window of a plain X11 session with feh, which takes one
+   * image per screen
+   */
+  class FehSetter : public CommandSetter
+  {
+    public:
+      QString name() const { return "feh"; }
+
+      static bool isAvailable()
+      {
+        return UNIX && !qgetenv("DISPLAY").isEmpty() &&
+               !findExecutable(QStringList() << "feh").isEmpty();
+      }
+
+    protected:
+      CommandList commands(const QStringList& fileNames, int) const
+      {
+        return CommandList() <<
+          Command(findExecutable(QStringList() << "feh"),
+                  QStringList() << "--no-fehbg" << "--bg-fill" << fileNames);
+      }
+  };
+
+
+  /**
+   * Sets the root window of a plain X11 session with xwallpaper
+   */
+  class XwallpaperSetter : public CommandSetter
+  {
+    public:
+      QString name() const { return "xwallpaper"; }
+
+      static bool isAvailable()
+      {
+        return UNIX && !qgetenv("DISPLAY").isEmpty() &&
+               !findExecutable(QStringList() << "xwallpaper").isEmpty();
+      }
+
+    protected:
+      CommandList commands(const QStringList& fileNames,
+                           int primaryScreen) const
+      {
+        return CommandList() <<
+          Command(findExecutable(QStringList() << "xwallpaper"),
+                  QStringList() << "--zoom" <<
+                    fileNames.value(primaryScreen, fileNames.value(0)));
+      }
+  };
+}
+
+
+/**
+ * Constructor
+ */
+WallpaperSetter::WallpaperSetter(QObject* parent)
+  : QObject(parent)
+{
+}
+
+/**
+ * Destructor
+ */
+WallpaperSetter::~WallpaperSetter()
+{
+}
+
+/**
+ * Returns the backend for the desktop we're running under, or NULL if we
+ * don't know how to set the wallpaper here.  The "wallpaper/setter" setting
+ * may name a backend to use instead of the one we'd pick.
+ */
+WallpaperSetter* WallpaperSetter::detect(QObject* parent)
+{
+  QSettings settings;
+  QString wanted = settings.value("wallpaper/setter").toString();
+  bool any = wanted.isEmpty();
+
+  // In order of preference
+  WallpaperSetter* setter = NULL;
+  if ((any || wanted == "macos") && MacScriptSetter::isAvailable()) {
+    setter = new MacScriptSetter();
+  } else if ((any || wanted == "win32") && Win32Setter::isAvailable()) {
+    setter = new Win32Setter();
+  } else if ((any || wanted == "kde") && KdeSetter::isAvailable()) {
+    setter = new KdeSetter();
+  } else if ((any || wanted == "gnome") && GnomeSetter::isAvailable()) {
+    setter = new GnomeSetter();
+  } else if ((any || wanted == "xfce") && XfceSetter::isAvailable()) {
+    setter = new XfceSetter();
+  } else if ((any || wanted == "feh") && FehSetter::isAvailable()) {
+    setter = new FehSetter();
+  } else if ((any || wanted == "xwallpaper") &&
+             XwallpaperSetter::isAvailable()) {
+    setter = new XwallpaperSetter();
+  }
+
+  if (setter) {
+    setter->setParent(parent);
+  }
+  return setter;
+}
+
+/**
+ * Returns the full path of the first of the given programs found on the PATH,
+ * or an empty string if there are none
+ */
+QString WallpaperSetter::findExecutable(const QStringList& names)
+{
+  QStringList path = QString::fromLocal8Bit(qgetenv("PATH")).
+                       split(WINDOWS ? ';' : ':', QString::SkipEmptyParts);
+  foreach (QString name, names) {
+    foreach (QString dir, path) {
+      QFileInfo info(QDir(dir), name);
+      if (info.isFile() && info.isExecutable()) {
+        return info.absoluteFilePath();
+      }
+    }
+  }
+  return QString();
+}
+
+/**
+ * Returns how long a backend may take over any one step of setting the
+ * wallpaper, which may be set with "wallpaper/setterTimeoutSecs"
+ */
+int WallpaperSetter::timeoutMsecs()
+{
+  QSettings settings;
+  int secs = settings.value("wallpaper/setterTimeoutSecs",
+                            DefaultTimeoutSecs).toInt();
+  return qMax(1, secs) * 1000;
+}
+
+/**
+ * Emits finished() once control returns to the event loop, so that it is
+ * never emitted from within start()
+ */
+void WallpaperSetter::finishLater(bool succeeded, const QString& errorString)
+{
+  QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection,
+                            Q_ARG(bool, succeeded),
+                            Q_ARG(QString, errorString));
+}
+
+
+/**
+ * Constructor
+ */
+CommandSetter::CommandSetter(QObject* parent)
+  : WallpaperSetter(parent),
+    mProcess(NULL),
+    mTimer(),
+    mCommands(),
+    mFileNames(),
+    mPrimaryScreen(0)
+{
+  mTimer.setSingleShot(true);
+  connect(&mTimer, SIGNAL(timeout()), this, SLOT(processTimedOut()));
+}
+
+/**
+ * Destructor
+ */
+CommandSetter::~CommandSetter()
+{
+  stopProcess();
+}
+
+/**
+ * Starts running the commands that set \a fileNames, abandoning any earlier
+ * attempt still running
+ */
+void CommandSetter::start(const QStringList& fileNames, int primaryScreen)
+{
+  stopProcess();
+  mTimer.setInterval(timeoutMsecs());
+  mFileNames = fileNames;
+  mPrimaryScreen = primaryScreen;
+  mCommands = commands(fileNames, primaryScreen);
+  runNext();
+}
+
+/**
+ * The commands to run once \a command has produced \a output, ahead of any
+ * still waiting.  By default there are none.
+ */
+CommandSetter::CommandList CommandSetter::followOn(const Command&,
+                                                   const QByteArray&,
+                                                   const QStringList&,
+                                                   int) const
+{
+  return CommandList();
+}
+
+/**
+ * Starts the next command, or reports success if there are none left
+ */
+void CommandSetter::runNext()
+{
+  if (mCommands.isEmpty()) {
+    finishLater(true);
+    return;
+  }
+
+  mProcess = new QProcess(this);
+  connect(mProcess, SIGNAL(finished(int, QProcess::ExitStatus)),
+          this, SLOT(processFinished(int, QProcess::ExitStatus)));
+  connect(mProcess, SIGNAL(error(QProcess::ProcessError)),
+          this, SLOT(processError(QProcess::ProcessError)));
+  mProcess->start(mCommands.first().program, mCommands.first().arguments);
+  mTimer.start();
+}
+
+/**
+ * Called when the current command exits
+ */
+void CommandSetter::processFinished(int exitCode,
+                                    QProcess::ExitStatus exitStatus)
+{
+  if (exitStatus != QProcess::NormalExit || exitCode != 0) {
+    commandFinished(false, tr("%1 failed with exit code %2.").
+                             arg(QFileInfo(mCommands.first().program).
+                                   fileName()).
+                             arg(exitCode));
+    return;
+  }
+
+  Command command = mCommands.takeFirst();
+  QByteArray output = mProcess->readAllStandardOutput();
+  CommandList next = followOn(command, output, mFileNames, mPrimaryScreen);
+  mCommands = next + mCommands;
+  commandFinished(true, QString());
+}
+
+/**
+ * Called if the current command couldn't be run.  Crashes are dealt with in
+ * processFinished().
+ */
+void CommandSetter::processError(QProcess::ProcessError error)
+{
+  if (error == QProcess::FailedToStart) {
+    commandFinished(false, tr("Unable to run %1.").
+                             arg(mCommands.first().program));
+  }
+}
+
+/**
+ * Called if the current command is taking too long
+ */
+void CommandSetter::processTimedOut()
+{
+  commandFinished(false, tr("%1 did not respond.").
+                           arg(QFileInfo(mCommands.first().program).
+                                 fileName()));
+}
+
+/**
+ * Moves on from the current command.  A failed command fails the whole
+ * operation, unless it is optional.
+ */
+void CommandSetter::commandFinished(bool succeeded,
+                                    const QString& errorString)
+{
+  stopProcess();
+  if (!succeeded) {
+    if (!mCommands.takeFirst().optional) {
+      mCommands.clear();
+      finishLater(false, errorString);
+      return;
+    }
+  }
+  runNext();
+}
+
+/**
+ * Kills the current command, if any, without further notification
+ */
+void CommandSetter::stopProcess()
+{
+  mTimer.stop();
+  if (mProcess) {
+    mProcess->disconnect(this);
+    if (mProcess->state() != QProcess::NotRunning) {
+      mProcess->kill();
+    }
+    mProcess->deleteLater();
+    mProcess = NULL;
+  }
+}
+
+
+/**
+ * Constructor
+ */
+BlockingSetter::BlockingSetter(BlockingCall call, QObject* parent)
+  : WallpaperSetter(parent),
+    mCall(call),
+    mWatcher(NULL),
+    mTimer()
+{
+  mTimer.setSingleShot(true);
+  connect(&mTimer, SIGNAL(timeout()), this, SLOT(callTimedOut()));
+}
+
+/**
+ * Destructor.  A call still running is left to finish on its own.
+ */
+BlockingSetter::~BlockingSetter()
+{
+  abandonCall();
+}
+
+/**
+ * Makes the call that sets \a fileNames on a worker thread, abandoning any
+ * earlier call still running
+ */
+void BlockingSetter::start(const QStringList& fileNames, int primaryScreen)
+{
+  abandonCall();
+  mWatcher = new QFutureWatcher<bool>(this);
+  connect(mWatcher, SIGNAL(finished()), this, SLOT(callFinished()));
+  mWatcher->setFuture(QtConcurrent::run(mCall, fileNames, primaryScreen));
+  mTimer.start(timeoutMsecs());
+}
+
+/**
+ * Called when the call has returned in time
+ */
+void BlockingSetter::callFinished()
+{
+  bool succeeded = mWatcher->result();
+  abandonCall();
+  finishLater(succeeded, succeeded ? QString() : failureMessage());
+}
+
+/**
+ * Called if the call is taking too long
+ */
+void BlockingSetter::callTimedOut()
+{
+  abandonCall();
+  finishLater(false, tr("The desktop did not respond."));
+}
+
+/**
+ * Stops waiting for the current call, if there is one
+ */
+void BlockingSetter::abandonCall()
+{
+  mTimer.stop();
+  if (mWatcher) {
+    mWatcher->disconnect(this);
+    mWatcher->deleteLater();
+    mWatcher = NULL;
+  }
+}
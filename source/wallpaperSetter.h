@@ -0,0 +1,152 @@
+/**
+ * Copyright (c) 2008, Paul Gideon Dann
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WALLPAPERSETTER_H
+#define WALLPAPERSETTER_H
+
+#include <QtCore>
+
+
+/**
+ * A way of handing wallpaper images to the desktop.  Setting is asynchronous:
+ * start() returns straight away, and finished() is emitted once the desktop
+ * has been updated (or the attempt has failed or timed out).  Starting again
+ * while a previous attempt is running abandons the previous one.
+ *
+ * detect() picks the backend suited to the desktop we're running under.
+ */
+class WallpaperSetter : public QObject
+{
+  Q_OBJECT
+
+  public:
+    WallpaperSetter(QObject* parent = 0);
+    virtual ~WallpaperSetter();
+    static WallpaperSetter* detect(QObject* parent = 0);
+    static QString findExecutable(const QStringList& names);
+    virtual QString name() const = 0;
+    virtual void start(const QStringList& fileNames, int primaryScreen) = 0;
+
+  signals:
+    void finished(bool succeeded, const QString& errorString);
+
+  protected:
+    static int timeoutMsecs();
+    void finishLater(bool succeeded, const QString& errorString = QString());
+};
+
+
+/**
+ * A backend that sets the wallpaper by running a sequence of external
+ * commands, each of which must succeed within a time limit.  The output of
+ * each command may be used to decide what to run next (see followOn()).
+ */
+class CommandSetter : public WallpaperSetter
+{
+  Q_OBJECT
+
+  public:
+    CommandSetter(QObject* parent = 0);
+    ~CommandSetter();
+    void start(const QStringList& fileNames, int primaryScreen);
+
+  protected:
+    struct Command
+    {
+      Command(const QString& program = QString(),
+              const QStringList& arguments = QStringList(),
+              bool optional = false)
+        : program(program), arguments(arguments), optional(optional) {}
+
+      QString program;
+      QStringList arguments;
+      // If set, failure of this command doesn't fail the whole operation
+      bool optional;
+    };
+    typedef QList<Command> CommandList;
+
+    virtual CommandList commands(const QStringList& fileNames,
+                                 int primaryScreen) const = 0;
+    virtual CommandList followOn(const Command& command,
+                                 const QByteArray& output,
+                                 const QStringList& fileNames,
+                                 int primaryScreen) const;
+
+  private slots:
+    void processFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    void processError(QProcess::ProcessError error);
+    void processTimedOut();
+
+  private:
+    QProcess* mProcess;
+    QTimer mTimer;
+    CommandList mCommands;
+    QStringList mFileNames;
+    int mPrimaryScreen;
+
+    void runNext();
+    void commandFinished(bool succeeded, const QString& errorString);
+    void stopProcess();
+};
+
+
+/**
+ * A backend that sets the wallpaper with a blocking call, such as one that
+ * waits on every window of the desktop.  The call is made on a worker thread,
+ * and if it doesn't return within a time limit, the attempt fails; the call
+ * is left to finish in its own time, and its result ignored.  The call is a
+ * plain function, rather than a member, so that it may outlive the setter.
+ */
+class BlockingSetter : public WallpaperSetter
+{
+  Q_OBJECT
+
+  public:
+    typedef bool (*BlockingCall)(const QStringList& fileNames,
+                                 int primaryScreen);
+
+    BlockingSetter(BlockingCall call, QObject* parent = 0);
+    ~BlockingSetter();
+    void start(const QStringList& fileNames, int primaryScreen);
+
+  protected:
+    virtual QString failureMessage() const = 0;
+
+  private slots:
+    void callFinished();
+    void callTimedOut();
+
+  private:
+    BlockingCall mCall;
+    QFutureWatcher<bool>* mWatcher;
+    QTimer mTimer;
+
+    void abandonCall();
+};
+
+#endif